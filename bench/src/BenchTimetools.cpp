@@ -0,0 +1,333 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "Results.h"
+#include "../../lib/include/CoreLatency.h"
+#include "../../lib/include/JitterMeter.h"
+#include "../../lib/include/StartBarrier.h"
+#include "../../lib/include/Utility.h"
+
+namespace {
+    struct Settings {
+        std::string jsonPath;
+        std::string csvPath;
+        uint64_t maximumWaitNanoseconds = 1000000;
+        uint64_t budgetNanosecondsPerPoint = 20000000;
+        uint64_t stopwatchSamples = 100000;
+        std::vector<unsigned int> threadCounts;
+        bool realtime = false;
+    };
+
+    constexpr std::pair<timetools::WaitStrategy, const char *> WAIT_STRATEGIES[] = {
+        {timetools::WaitStrategy::PauseLoop, "PauseLoop"},
+        {timetools::WaitStrategy::UnrolledPauseLoop, "UnrolledPauseLoop"},
+        {timetools::WaitStrategy::Rdtscp, "Rdtscp"},
+        {timetools::WaitStrategy::Tpause, "Tpause"},
+        {timetools::WaitStrategy::Nanosleep, "Nanosleep"},
+        {timetools::WaitStrategy::SystemClockSpin, "SystemClockSpin"},
+        {timetools::WaitStrategy::ThreadSleep, "ThreadSleep"},
+        {timetools::WaitStrategy::Hybrid, "Hybrid"},
+    };
+
+    // Runs the benchmark on the given number of threads at once, each pinned to its own core where there are
+    // enough, and merges what they measured.
+    template<typename Measure>
+    timetools::LatencyHistogram runOnThreads(timetools::TimerFactory &factory, const std::vector<int> &cpus,
+                                             const unsigned int threadCount, const bool realtime, Measure measure) {
+        timetools::LatencyHistogram merged;
+        std::mutex mergedMutex;
+        timetools::StartBarrier barrier(factory, threadCount);
+        std::vector<std::thread> threads;
+        for (unsigned int i = 0; i < threadCount; ++i) {
+            threads.emplace_back([&, i]() {
+                (void) timetools::setThisThreadAffinity(cpus[i % cpus.size()]);
+                if (realtime)
+                    (void) timetools::setThisThreadFifoRealtimePriority(95);
+                // Start together, so that every core is loaded for the whole measurement.
+                barrier.arriveAndWait();
+                const auto histogram = measure();
+                std::lock_guard lock(mergedMutex);
+                merged.merge(histogram);
+            });
+        }
+        for (auto &thread: threads)
+            thread.join();
+        if (threadCount > 1)
+            std::cerr << "  threads started within " << barrier.getLastRelease().skewNanoseconds << " ns\n";
+        return merged;
+    }
+
+    timetools::LatencyHistogram measureWaits(timetools::TimerFactory &factory, const timetools::WaitStrategy strategy,
+                                             const uint64_t waitNanoseconds, const uint64_t budgetNanoseconds) {
+        constexpr uint64_t MINIMUM_TRIALS = 10;
+        constexpr uint64_t MAXIMUM_TRIALS = 100000;
+        auto waiter = factory.createWaiter(strategy);
+        auto stopwatch = factory.createStopwatch();
+        timetools::LatencyHistogram histogram;
+        // Budget by how long the waits actually take, since the sleeping strategies overshoot short waits a lot.
+        uint64_t spentNanoseconds = 0;
+        for (uint64_t trial = 0;
+             trial < MAXIMUM_TRIALS && (trial < MINIMUM_TRIALS || spentNanoseconds < budgetNanoseconds); ++trial) {
+            stopwatch.reset();
+            stopwatch.start();
+            waiter.busyWait(waitNanoseconds);
+            stopwatch.stop();
+            const auto actualNanoseconds = stopwatch.getElapsedNanoseconds();
+            histogram.record(actualNanoseconds);
+            spentNanoseconds += actualNanoseconds;
+        }
+        return histogram;
+    }
+
+    using StopwatchBenchmark = timetools::LatencyHistogram (*)(timetools::TimerFactory &, uint64_t samples);
+
+    template<typename ClockPolicy, typename FencePolicy>
+    timetools::LatencyHistogram measureEmptyReadings(timetools::TimerFactory &factory, const uint64_t samples) {
+        auto stopwatch = factory.createStopwatch<ClockPolicy, FencePolicy>();
+        timetools::LatencyHistogram histogram;
+        for (uint64_t sample = 0; sample < samples; ++sample) {
+            stopwatch.reset();
+            stopwatch.start();
+            stopwatch.stop();
+            histogram.record(stopwatch.getElapsedNanoseconds());
+        }
+        return histogram;
+    }
+
+    template<typename ClockPolicy, typename... FencePolicies>
+    void addEachFence(std::vector<std::pair<std::string, StopwatchBenchmark>> &benchmarks) {
+        (benchmarks.emplace_back(std::string(ClockPolicy::NAME) + "+" + FencePolicies::NAME,
+                                 &measureEmptyReadings<ClockPolicy, FencePolicies>), ...);
+    }
+
+    std::vector<uint64_t> getWaitSweep(const uint64_t maximum) {
+        std::vector<uint64_t> waits;
+        for (uint64_t decade = 10; decade <= maximum; decade *= 10) {
+            for (const uint64_t step: {1, 2, 5}) {
+                if (decade * step <= maximum)
+                    waits.push_back(decade * step);
+            }
+        }
+        return waits;
+    }
+
+    // Stopwatch rows come from a factory that doesn't subtract each configuration's overhead, which would otherwise
+    // leave every row at about zero.
+    std::vector<bench::Result> runAll(timetools::TimerFactory &factory, timetools::TimerFactory &uncompensatedFactory,
+                                      const Settings &settings) {
+        const auto cpus = timetools::detail::getOnlineCpus();
+        std::vector<std::pair<std::string, unsigned int>> loads;
+        for (const auto threads: settings.threadCounts)
+            loads.emplace_back(threads == 1 ? "idle" : "loaded", threads);
+        if (loads.empty()) {
+            loads.emplace_back("idle", 1);
+            if (cpus.size() > 1)
+                loads.emplace_back("loaded", cpus.size());
+        }
+
+        std::vector<std::pair<std::string, StopwatchBenchmark>> stopwatches;
+        addEachFence<timetools::RdtscClock, timetools::NoFence, timetools::LoadFence, timetools::MemoryFence,
+            timetools::SerializingFence>(stopwatches);
+        addEachFence<timetools::RdtscpClock, timetools::NoFence, timetools::LoadFence, timetools::MemoryFence,
+            timetools::SerializingFence>(stopwatches);
+        addEachFence<timetools::MonotonicRawClock, timetools::NoFence, timetools::LoadFence, timetools::MemoryFence,
+            timetools::SerializingFence>(stopwatches);
+
+        // Measure the error models up front, rather than in every thread at once.
+        for (const auto &[strategy, name]: WAIT_STRATEGIES)
+            (void) factory.createWaiter(strategy);
+
+        std::vector<bench::Result> results;
+        for (const auto &[load, threads]: loads) {
+            for (const auto &[name, measure]: stopwatches) {
+                std::cerr << "stopwatch " << name << ", " << threads << " thread(s)\n";
+                auto histogram = runOnThreads(factory, cpus, threads, settings.realtime, [&, measure]() {
+                    return measure(uncompensatedFactory, settings.stopwatchSamples);
+                });
+                results.push_back({"stopwatch", name, load, 0, threads, std::move(histogram)});
+            }
+            for (const auto &[strategy, name]: WAIT_STRATEGIES) {
+                std::cerr << "wait " << name << ", " << threads << " thread(s)\n";
+                for (const auto wait: getWaitSweep(settings.maximumWaitNanoseconds)) {
+                    auto histogram = runOnThreads(factory, cpus, threads, settings.realtime, [&, strategy, wait]() {
+                        return measureWaits(factory, strategy, wait, settings.budgetNanosecondsPerPoint);
+                    });
+                    results.push_back({"wait", name, load, wait, threads, std::move(histogram)});
+                }
+            }
+        }
+        return results;
+    }
+
+    int usage() {
+        std::cerr << "Usage:\n"
+                "  bench-timetools run [--json FILE] [--csv FILE] [--max-wait-ns N] [--budget-ms N]\n"
+                "                      [--stopwatch-samples N] [--threads N]... [--realtime]\n"
+                "  bench-timetools compare BASELINE.csv CANDIDATE.csv [--significance P] [--min-change-ns N]\n"
+                "                          [--min-change-percent N]\n"
+                "  bench-timetools jitter [--cpus LIST] [--duration-ms N] [--threshold-ns N] [--priority N]\n"
+                "                         [--quiet-ns N]\n"
+                "  bench-timetools core-latency [--cpus LIST] [--round-trips N] [--percentile P] [--csv FILE]\n"
+                "                               [--json FILE]\n";
+        return 2;
+    }
+
+    int run(const int argc, char **argv) {
+        Settings settings;
+        for (int i = 2; i < argc; ++i) {
+            const std::string argument = argv[i];
+            const auto hasValue = i + 1 < argc;
+            if (argument == "--json" && hasValue)
+                settings.jsonPath = argv[++i];
+            else if (argument == "--csv" && hasValue)
+                settings.csvPath = argv[++i];
+            else if (argument == "--max-wait-ns" && hasValue)
+                settings.maximumWaitNanoseconds = std::stoull(argv[++i]);
+            else if (argument == "--budget-ms" && hasValue)
+                settings.budgetNanosecondsPerPoint = std::stoull(argv[++i]) * 1000000;
+            else if (argument == "--stopwatch-samples" && hasValue)
+                settings.stopwatchSamples = std::stoull(argv[++i]);
+            else if (argument == "--threads" && hasValue)
+                settings.threadCounts.push_back(std::stoul(argv[++i]));
+            else if (argument == "--realtime")
+                settings.realtime = true;
+            else
+                return usage();
+        }
+
+        timetools::TimerFactoryOptions options;
+        options.eagerCalibration = true;
+        timetools::TimerFactory factory(options);
+        options.compensateOverhead = false;
+        timetools::TimerFactory uncompensatedFactory(options);
+        const auto machine = bench::describeMachine(factory);
+        const auto results = runAll(factory, uncompensatedFactory, settings);
+
+        if (!settings.jsonPath.empty()) {
+            std::ofstream json(settings.jsonPath);
+            bench::writeJson(json, machine, results);
+        }
+        if (!settings.csvPath.empty()) {
+            std::ofstream csv(settings.csvPath);
+            bench::writeCsv(csv, results);
+        }
+        if (settings.jsonPath.empty() && settings.csvPath.empty())
+            bench::writeCsv(std::cout, results);
+        return 0;
+    }
+
+    int compare(const int argc, char **argv) {
+        if (argc < 4)
+            return usage();
+        double significance = 0.001;
+        double minimumChangeNanoseconds = 25;
+        double minimumChangePercent = 10;
+        for (int i = 4; i < argc; ++i) {
+            const std::string argument = argv[i];
+            if (argument == "--significance" && i + 1 < argc)
+                significance = std::stod(argv[++i]);
+            else if (argument == "--min-change-ns" && i + 1 < argc)
+                minimumChangeNanoseconds = std::stod(argv[++i]);
+            else if (argument == "--min-change-percent" && i + 1 < argc)
+                minimumChangePercent = std::stod(argv[++i]);
+            else
+                return usage();
+        }
+        const auto baseline = bench::readCsv(argv[2]);
+        const auto candidate = bench::readCsv(argv[3]);
+        const auto regressions = bench::compareResults(baseline, candidate, significance, minimumChangeNanoseconds,
+                                                       minimumChangePercent, std::cout);
+        std::cout << regressions << " regression(s)\n";
+        return regressions == 0 ? 0 : 1;
+    }
+
+    // Spins on each cpu and reports the gaps, then lists the cpus quiet enough for a spinning Waiter.
+    int jitter(const int argc, char **argv) {
+        timetools::JitterOptions options;
+        uint64_t quietNanoseconds = 20000;
+        for (int i = 2; i < argc; ++i) {
+            const std::string argument = argv[i];
+            const auto hasValue = i + 1 < argc;
+            if (argument == "--cpus" && hasValue)
+                options.cpus = timetools::detail::parseCpuList(argv[++i]);
+            else if (argument == "--duration-ms" && hasValue)
+                options.durationNanoseconds = std::stoull(argv[++i]) * 1000000;
+            else if (argument == "--threshold-ns" && hasValue)
+                options.thresholdNanoseconds = std::stoull(argv[++i]);
+            else if (argument == "--priority" && hasValue)
+                options.realtimePriority = std::stoi(argv[++i]);
+            else if (argument == "--quiet-ns" && hasValue)
+                quietNanoseconds = std::stoull(argv[++i]);
+            else
+                return usage();
+        }
+        timetools::TimerFactory factory;
+        const auto report = timetools::measureJitter(factory, options);
+        report.print(std::cout);
+        std::cout << "Never lost more than " << quietNanoseconds << " ns at once:";
+        for (const auto cpu: report.getQuietCpus(quietNanoseconds))
+            std::cout << " " << cpu;
+        std::cout << "\n";
+        return 0;
+    }
+
+    // Bounces a cache line between each pair of cpus, to choose where producers and consumers should run.
+    int coreLatency(const int argc, char **argv) {
+        timetools::CoreLatencyOptions options;
+        double percentile = 50;
+        std::string csvPath;
+        std::string jsonPath;
+        for (int i = 2; i < argc; ++i) {
+            const std::string argument = argv[i];
+            const auto hasValue = i + 1 < argc;
+            if (argument == "--cpus" && hasValue)
+                options.cpus = timetools::detail::parseCpuList(argv[++i]);
+            else if (argument == "--round-trips" && hasValue)
+                options.roundTrips = std::stoull(argv[++i]);
+            else if (argument == "--percentile" && hasValue)
+                percentile = std::stod(argv[++i]);
+            else if (argument == "--csv" && hasValue)
+                csvPath = argv[++i];
+            else if (argument == "--json" && hasValue)
+                jsonPath = argv[++i];
+            else
+                return usage();
+        }
+        timetools::TimerFactory factory;
+        const auto matrix = timetools::measureCoreLatency(factory, options);
+        matrix.print(std::cout, percentile);
+        if (!csvPath.empty()) {
+            std::ofstream csv(csvPath);
+            matrix.writeCsv(csv, percentile);
+        }
+        if (!jsonPath.empty()) {
+            std::ofstream json(jsonPath);
+            matrix.writeJson(json);
+        }
+        return 0;
+    }
+}
+
+int main(const int argc, char **argv) {
+    if (argc < 2)
+        return usage();
+    try {
+        if (std::strcmp(argv[1], "run") == 0)
+            return run(argc, argv);
+        if (std::strcmp(argv[1], "compare") == 0)
+            return compare(argc, argv);
+        if (std::strcmp(argv[1], "jitter") == 0)
+            return jitter(argc, argv);
+        if (std::strcmp(argv[1], "core-latency") == 0)
+            return coreLatency(argc, argv);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return usage();
+}
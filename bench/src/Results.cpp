@@ -0,0 +1,203 @@
+#include "Results.h"
+#include <algorithm>
+#include <cmath>
+#include <cpuid.h>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "../../lib/include/Utility.h"
+
+namespace bench {
+    std::string Result::getKey() const {
+        return kind + "/" + name + "/" + load + "/" + std::to_string(threads) + "/"
+               + std::to_string(intendedNanoseconds);
+    }
+
+    static std::string getCpuBrand() {
+        char brand[49] = {};
+        for (uint32_t leaf = 0; leaf < 3; ++leaf) {
+            uint32_t registers[4];
+            if (!__get_cpuid(0x80000002 + leaf, &registers[0], &registers[1], &registers[2], &registers[3]))
+                return "unknown";
+            std::memcpy(brand + leaf * 16, registers, sizeof(registers));
+        }
+        std::string trimmed(brand);
+        trimmed.erase(0, trimmed.find_first_not_of(' '));
+        return trimmed;
+    }
+
+    MachineDescription describeMachine(timetools::TimerFactory &factory) {
+        MachineDescription machine;
+        char host[256] = {};
+        gethostname(host, sizeof(host) - 1);
+        machine.host = host;
+        machine.cpu = getCpuBrand();
+        unsigned int cpu;
+        __rdtscp(&cpu);
+        (void) factory.createStopwatch();
+        machine.tscFrequencyHz = factory.getTscFrequencyHz(cpu & timetools::detail::TSC_AUX_CPU_MASK);
+        machine.onlineCpus = timetools::detail::getOnlineCpus().size();
+        return machine;
+    }
+
+    static void writeJsonString(std::ostream &out, const std::string &text) {
+        out << '"';
+        for (const auto c: text) {
+            if (c == '"' || c == '\\')
+                out << '\\';
+            out << c;
+        }
+        out << '"';
+    }
+
+    static std::string toHex(const std::vector<uint8_t> &bytes) {
+        constexpr char HEX[] = "0123456789abcdef";
+        std::string hex;
+        hex.reserve(bytes.size() * 2);
+        for (const auto byte: bytes) {
+            hex.push_back(HEX[byte >> 4]);
+            hex.push_back(HEX[byte & 0xf]);
+        }
+        return hex;
+    }
+
+    static std::vector<uint8_t> fromHex(const std::string &hex) {
+        if (hex.size() % 2 != 0)
+            throw std::runtime_error("Odd-length histogram");
+        std::vector<uint8_t> bytes(hex.size() / 2);
+        for (size_t i = 0; i < bytes.size(); ++i)
+            bytes[i] = static_cast<uint8_t>(std::stoi(hex.substr(2 * i, 2), nullptr, 16));
+        return bytes;
+    }
+
+    void writeJson(std::ostream &out, const MachineDescription &machine, const std::vector<Result> &results) {
+        out << "{\"machine\":{\"host\":";
+        writeJsonString(out, machine.host);
+        out << ",\"cpu\":";
+        writeJsonString(out, machine.cpu);
+        out << ",\"tscFrequencyHz\":" << machine.tscFrequencyHz << ",\"onlineCpus\":" << machine.onlineCpus << "},\n";
+        out << "\"results\":[";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const auto &result = results[i];
+            out << (i == 0 ? "\n" : ",\n") << "{\"kind\":\"" << result.kind << "\",\"name\":";
+            writeJsonString(out, result.name);
+            out << ",\"load\":\"" << result.load << "\",\"threads\":" << result.threads
+                    << ",\"intendedNanoseconds\":" << result.intendedNanoseconds
+                    << ",\"samples\":" << result.nanoseconds.getCount()
+                    << ",\"meanNanoseconds\":" << result.nanoseconds.getMean() << ",\"percentiles\":{";
+            for (size_t p = 0; p < std::size(REPORTED_PERCENTILES); ++p) {
+                out << (p == 0 ? "" : ",") << "\"" << REPORTED_PERCENTILES[p] << "\":"
+                        << result.nanoseconds.getValueAtPercentile(REPORTED_PERCENTILES[p]);
+            }
+            out << "},\"histogram\":\"" << toHex(result.nanoseconds.serialize()) << "\"}";
+        }
+        out << "\n]}\n";
+    }
+
+    void writeCsv(std::ostream &out, const std::vector<Result> &results) {
+        out << "kind,name,load,threads,intended_ns,samples,mean_ns";
+        for (const auto percentile: REPORTED_PERCENTILES)
+            out << ",p" << percentile << "_ns";
+        out << ",histogram\n";
+        for (const auto &result: results) {
+            out << result.kind << "," << result.name << "," << result.load << "," << result.threads << ","
+                    << result.intendedNanoseconds << "," << result.nanoseconds.getCount() << ","
+                    << result.nanoseconds.getMean();
+            for (const auto percentile: REPORTED_PERCENTILES)
+                out << "," << result.nanoseconds.getValueAtPercentile(percentile);
+            out << "," << toHex(result.nanoseconds.serialize()) << "\n";
+        }
+    }
+
+    std::vector<Result> readCsv(const std::string &path) {
+        std::ifstream in(path);
+        if (!in)
+            throw std::runtime_error("Couldn't open " + path);
+        std::string line;
+        std::getline(in, line); // The header
+        std::vector<Result> results;
+        while (std::getline(in, line)) {
+            if (line.empty())
+                continue;
+            std::vector<std::string> fields;
+            std::stringstream stream(line);
+            for (std::string field; std::getline(stream, field, ',');)
+                fields.push_back(field);
+            if (fields.size() != 8 + std::size(REPORTED_PERCENTILES))
+                throw std::runtime_error("Malformed line in " + path + ": " + line);
+            const auto histogram = fromHex(fields.back());
+            results.push_back({
+                fields[0], fields[1], fields[2], std::stoull(fields[4]),
+                static_cast<unsigned int>(std::stoul(fields[3])),
+                timetools::LatencyHistogram::deserialize(histogram.data(), histogram.size())
+            });
+        }
+        return results;
+    }
+
+    // Two-sided Mann-Whitney U test on two histograms, treating values in the same bucket as ties.
+    // Returns the p-value of the hypothesis that neither tends to be larger than the other.
+    static double mannWhitneyPValue(const timetools::LatencyHistogram &first,
+                                    const timetools::LatencyHistogram &second) {
+        const auto firstCount = static_cast<double>(first.getCount());
+        const auto secondCount = static_cast<double>(second.getCount());
+        const auto total = firstCount + secondCount;
+        if (firstCount == 0 || secondCount == 0)
+            return 1;
+        double u = 0, tieCorrection = 0, firstBelow = 0;
+        for (size_t i = 0; i < timetools::LatencyHistogram::BUCKET_COUNT; ++i) {
+            const auto a = static_cast<double>(first.getCountInBucket(i));
+            const auto b = static_cast<double>(second.getCountInBucket(i));
+            u += b * (firstBelow + a / 2);
+            firstBelow += a;
+            const auto ties = a + b;
+            tieCorrection += ties * ties * ties - ties;
+        }
+        const auto mean = firstCount * secondCount / 2;
+        const auto variance = firstCount * secondCount / 12 * (total + 1 - tieCorrection / (total * (total - 1)));
+        if (variance <= 0)
+            return 1;
+        const auto z = (u - mean) / std::sqrt(variance);
+        return std::erfc(std::abs(z) / std::sqrt(2));
+    }
+
+    int compareResults(const std::vector<Result> &baseline, const std::vector<Result> &candidate,
+                       const double significance, const double minimumChangeNanoseconds,
+                       const double minimumChangePercent, std::ostream &out) {
+        int regressions = 0;
+        out << "Verdict\tBenchmark\tBaseline p50 error (ns)\tCandidate p50 error (ns)\t"
+                "Baseline p99 (ns)\tCandidate p99 (ns)\tp-value\n";
+        for (const auto &after: candidate) {
+            const auto before = std::find_if(baseline.begin(), baseline.end(), [&after](const Result &result) {
+                return result.getKey() == after.getKey();
+            });
+            if (before == baseline.end())
+                continue;
+            const auto intended = static_cast<double>(after.intendedNanoseconds);
+            const auto errorBefore = std::abs(static_cast<double>(before->nanoseconds.getValueAtPercentile(50))
+                                              - intended);
+            const auto errorAfter = std::abs(static_cast<double>(after.nanoseconds.getValueAtPercentile(50))
+                                             - intended);
+            const auto pValue = mannWhitneyPValue(before->nanoseconds, after.nanoseconds);
+            // Medians are only known to the width of their bucket, so smaller changes than two buckets are noise.
+            const auto bucket = timetools::LatencyHistogram::getBucketIndex(after.nanoseconds.getValueAtPercentile(50));
+            const auto bucketWidth = timetools::LatencyHistogram::getBucketHighestValue(bucket)
+                                     - timetools::LatencyHistogram::getBucketLowestValue(bucket) + 1;
+            const auto change = std::abs(errorAfter - errorBefore);
+            if (pValue >= significance || change < minimumChangeNanoseconds
+                || change < errorBefore * minimumChangePercent / 100 || change <= 2.0 * bucketWidth)
+                continue;
+            const auto worse = errorAfter > errorBefore;
+            regressions += worse;
+            out << (worse ? "REGRESSED" : "improved") << "\t" << after.getKey() << "\t" << errorBefore << "\t"
+                    << errorAfter << "\t" << before->nanoseconds.getValueAtPercentile(99) << "\t"
+                    << after.nanoseconds.getValueAtPercentile(99) << "\t" << std::setprecision(3) << pValue
+                    << std::setprecision(6) << "\n";
+        }
+        return regressions;
+    }
+}
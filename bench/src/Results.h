@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "../../lib/include/timetools.h"
+
+namespace bench {
+    // The distribution of one benchmark at one setting.
+    struct Result {
+        std::string kind; // "wait" or "stopwatch"
+        std::string name; // The wait strategy, or the stopwatch's clock+fence
+        std::string load; // "idle" or "loaded"
+        uint64_t intendedNanoseconds; // The requested wait, or 0 for a stopwatch's empty reading
+        unsigned int threads;
+        timetools::LatencyHistogram nanoseconds;
+
+        // Identifies the result across runs.
+        [[nodiscard]] std::string getKey() const;
+    };
+
+    // The percentiles written to both formats.
+    constexpr double REPORTED_PERCENTILES[] = {0, 1, 10, 25, 50, 75, 90, 99, 99.9, 100};
+
+    struct MachineDescription {
+        std::string host;
+        std::string cpu;
+        uint64_t tscFrequencyHz;
+        unsigned int onlineCpus;
+    };
+
+    [[nodiscard]] MachineDescription describeMachine(timetools::TimerFactory &factory);
+
+    void writeJson(std::ostream &out, const MachineDescription &machine, const std::vector<Result> &results);
+
+    // One row per result. The last column holds the whole histogram, hex-encoded, for compare mode to read back.
+    void writeCsv(std::ostream &out, const std::vector<Result> &results);
+
+    // Reads a file written by writeCsv(). Throws std::runtime_error if it's malformed.
+    [[nodiscard]] std::vector<Result> readCsv(const std::string &path);
+
+    // Prints each result whose distribution differs significantly between the runs and whose median error changed
+    // by more than both minimums, and returns how many got worse.
+    int compareResults(const std::vector<Result> &baseline, const std::vector<Result> &candidate,
+                       double significance, double minimumChangeNanoseconds, double minimumChangePercent,
+                       std::ostream &out);
+}
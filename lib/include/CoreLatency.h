@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "timetools.h"
+
+namespace timetools {
+    struct CoreLatencyOptions {
+        // Empty to measure every online cpu this process may run on.
+        std::vector<int> cpus;
+        uint64_t roundTrips = 10000;
+        // Round trips before recording, to settle the line's coherence state and the cores' clocks.
+        uint64_t warmupRoundTrips = 1000;
+    };
+
+    struct CorePairLatency {
+        // 0, or the error from pinning either thread to its cpu.
+        int error;
+        // The time for a cache line to go to the other cpu and back, in nanoseconds. Empty on the diagonal.
+        LatencyHistogram roundTripNanoseconds;
+    };
+
+    struct CoreLatencyMatrix {
+        std::vector<int> cpus;
+        // cpus.size() squared, row by row. Each pair is measured once and the result shared by both orders, since a
+        // round trip crosses the interconnect both ways.
+        std::vector<CorePairLatency> pairs;
+
+        [[nodiscard]] const CorePairLatency &at(const size_t row, const size_t column) const {
+            return pairs[row * cpus.size() + column];
+        }
+
+        // The matrix at one percentile as a table, for reading at a terminal.
+        void print(std::ostream &out, double percentile = 50) const;
+
+        // A header row of cpus, then one row per cpu starting with the cpu, of round trips at the percentile in
+        // nanoseconds. Cells not measured are empty.
+        void writeCsv(std::ostream &out, double percentile = 50) const;
+
+        // An object holding the cpus, and the matrices of p50, p99, p99.9 and maximum round trips, with null for
+        // cells not measured.
+        void writeJson(std::ostream &out) const;
+    };
+
+    // Pins a pair of threads to each pair of cpus in turn and bounces a cache line between them: one writes a
+    // counter, the other waits to see it and writes it back. The first times each round trip with the TSC, at its
+    // own core's calibrated rate, so offsets between the cores' TSCs don't matter.
+    // Spinning threads yield after a long wait, so a partner that's been descheduled gets to run, but the results
+    // only mean something when each thread has its cpu to itself.
+    [[nodiscard]] CoreLatencyMatrix measureCoreLatency(TimerFactory &factory, const CoreLatencyOptions &options = {});
+}
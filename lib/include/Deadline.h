@@ -0,0 +1,89 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <immintrin.h>
+
+#include "timetools.h"
+
+namespace timetools {
+    // A time budget that's cheap enough to check inside the loop it guards: expired() is one rdtsc and a compare,
+    // or, with a poll interval of N, a countdown that reads the TSC only every Nth call. Once it has seen the
+    // deadline pass it stays expired without reading the TSC again.
+    // When expiry is first seen, how far past the deadline that was is kept, and recorded in a shared histogram if
+    // one is given, to tune poll intervals against. A deadline is for one thread; children can be handed to others.
+    class Deadline {
+        TscConversion conversion;
+        uint64_t deadlineTsc;
+        uint32_t pollInterval;
+        uint32_t pollsLeft;
+        bool isExpired = false;
+        uint64_t overshootNanoseconds = 0;
+        ShardedLatencyHistogram *overshoots;
+
+        Deadline(const TscConversion &conversion, uint64_t deadlineTsc, uint32_t pollInterval,
+                 ShardedLatencyHistogram *overshoots);
+
+        bool checkTsc() {
+            pollsLeft = pollInterval;
+            const auto now = __rdtsc();
+            if (now < deadlineTsc) [[likely]]
+                return false;
+            isExpired = true;
+            overshootNanoseconds = conversion.toNanoseconds(now - deadlineTsc);
+            if (overshoots != nullptr)
+                overshoots->record(overshootNanoseconds);
+            return true;
+        }
+
+    public:
+        // Expires budgetNanoseconds from now, at the current core's calibrated rate. A poll interval of 0 is taken
+        // as 1. The overshoot histogram, if any, must outlive the deadline and its children.
+        Deadline(TimerFactory &factory, uint64_t budgetNanoseconds, uint32_t pollInterval = 1,
+                 ShardedLatencyHistogram *overshoots = nullptr);
+
+        // A deadline budgetNanoseconds from now, or the parent's if that's sooner, with the parent's poll interval
+        // and overshoot histogram unless given others.
+        [[nodiscard]] Deadline createChild(uint64_t budgetNanoseconds) const {
+            return createChild(budgetNanoseconds, pollInterval);
+        }
+
+        [[nodiscard]] Deadline createChild(uint64_t budgetNanoseconds, uint32_t childPollInterval) const {
+            return createChild(budgetNanoseconds, childPollInterval, overshoots);
+        }
+
+        [[nodiscard]] Deadline createChild(uint64_t budgetNanoseconds, uint32_t childPollInterval,
+                                           ShardedLatencyHistogram *childOvershoots) const;
+
+        bool expired() {
+            if (isExpired) [[unlikely]]
+                return true;
+            if (--pollsLeft != 0) [[likely]]
+                return false;
+            return checkTsc();
+        }
+
+        // Reads the TSC now, regardless of the poll interval.
+        bool expiredNow() {
+            return isExpired || checkTsc();
+        }
+
+        // Zero once the deadline has passed, whether or not expired() has seen it yet.
+        [[nodiscard]] uint64_t getRemainingNanoseconds() const {
+            const auto now = __rdtsc();
+            return now < deadlineTsc ? conversion.toNanoseconds(deadlineTsc - now) : 0;
+        }
+
+        // How long after the deadline expired() first saw it pass, or zero if it hasn't yet.
+        [[nodiscard]] uint64_t getOvershootNanoseconds() const {
+            return overshootNanoseconds;
+        }
+
+        [[nodiscard]] uint64_t getDeadlineTsc() const {
+            return deadlineTsc;
+        }
+
+        [[nodiscard]] uint32_t getPollInterval() const {
+            return pollInterval;
+        }
+    };
+}
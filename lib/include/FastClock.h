@@ -0,0 +1,113 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <immintrin.h>
+#include <mutex>
+#include <thread>
+
+namespace timetools {
+    class TimerFactory;
+
+    struct FastClockOptions {
+        // How often the background thread compares the clock with clock_gettime and corrects it.
+        uint64_t refitIntervalNanoseconds = 100000000;
+        // The most the clock's rate may be changed by to work off an error, like adjtime's slew limit.
+        double maximumSlewPpm = 500;
+        // Errors larger than this are corrected at once rather than slewed, for example after a suspend.
+        uint64_t stepThresholdNanoseconds = 1000000;
+    };
+
+    // Timestamps compatible with CLOCK_MONOTONIC and CLOCK_REALTIME, read with a single rdtsc and a multiply.
+    // A background thread periodically refits the conversion against clock_gettime and publishes it through a
+    // seqlock. Small errors are slewed away, so readings stay continuous; only errors over the step threshold jump.
+    class FastClock {
+        // Bumped to odd before the parameters change and to even after.
+        alignas(64) std::atomic<uint64_t> sequence = 0;
+        std::atomic<uint64_t> baseTsc = 0;
+        std::atomic<uint64_t> baseMonotonicNs = 0;
+        std::atomic<int64_t> realtimeOffsetNs = 0;
+        std::atomic<uint64_t> nanosecondsPerTsc_shl32 = 0;
+
+        alignas(64) FastClockOptions options;
+        std::atomic<int64_t> lastErrorNs = 0;
+        std::atomic<uint64_t> stepCount = 0;
+
+        std::mutex stopMutex;
+        std::condition_variable stopCondition;
+        bool stopping = false;
+        std::thread refitter;
+
+        void refitLoop(double nanosecondsPerTsc);
+
+        static uint64_t convert(const uint64_t tsc, const uint64_t fromTsc, const uint64_t fromNs,
+                                const uint64_t nanosecondsPerTsc_shl32) {
+            // Another core's reading may be slightly behind the one the parameters were fitted at.
+            if (tsc <= fromTsc)
+                return fromNs;
+            return fromNs + static_cast<uint64_t>(static_cast<unsigned __int128>(tsc - fromTsc)
+                                                  * nanosecondsPerTsc_shl32 >> 32);
+        }
+
+        template<typename Read>
+        auto readConsistently(Read read) const {
+            while (true) {
+                const auto before = sequence.load(std::memory_order_acquire);
+                const auto result = read();
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (!(before & 1) && sequence.load(std::memory_order_relaxed) == before)
+                    return result;
+                _mm_pause();
+            }
+        }
+
+    public:
+        // Starts from the factory's rate for the current core, then starts the background thread.
+        explicit FastClock(TimerFactory &factory, const FastClockOptions &options = {});
+
+        ~FastClock();
+
+        FastClock(const FastClock &) = delete;
+
+        FastClock &operator=(const FastClock &) = delete;
+
+        // Converts a TSC reading to CLOCK_MONOTONIC nanoseconds.
+        [[nodiscard]] uint64_t toMonotonicNanoseconds(const uint64_t tsc) const {
+            return readConsistently([this, tsc]() {
+                return convert(tsc, baseTsc.load(std::memory_order_relaxed),
+                               baseMonotonicNs.load(std::memory_order_relaxed),
+                               nanosecondsPerTsc_shl32.load(std::memory_order_relaxed));
+            });
+        }
+
+        // Converts a TSC reading to CLOCK_REALTIME nanoseconds since the epoch.
+        [[nodiscard]] uint64_t toRealtimeNanoseconds(const uint64_t tsc) const {
+            return readConsistently([this, tsc]() {
+                return convert(tsc, baseTsc.load(std::memory_order_relaxed),
+                               baseMonotonicNs.load(std::memory_order_relaxed),
+                               nanosecondsPerTsc_shl32.load(std::memory_order_relaxed))
+                       + realtimeOffsetNs.load(std::memory_order_relaxed);
+            });
+        }
+
+        // CLOCK_REALTIME nanoseconds since the epoch.
+        [[nodiscard]] uint64_t now() const {
+            return toRealtimeNanoseconds(__rdtsc());
+        }
+
+        // CLOCK_MONOTONIC nanoseconds.
+        [[nodiscard]] uint64_t monotonicNow() const {
+            return toMonotonicNanoseconds(__rdtsc());
+        }
+
+        // How far ahead of clock_gettime the clock was at the last refit, before correcting.
+        [[nodiscard]] int64_t getLastErrorNanoseconds() const {
+            return lastErrorNs.load(std::memory_order_relaxed);
+        }
+
+        // Refits that found an error too large to slew away and jumped instead.
+        [[nodiscard]] uint64_t getStepCount() const {
+            return stepCount.load(std::memory_order_relaxed);
+        }
+    };
+}
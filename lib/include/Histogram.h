@@ -0,0 +1,162 @@
+#pragma once
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace timetools {
+    namespace detail {
+        unsigned int acquireThreadIndex();
+
+        void releaseThreadIndex(unsigned int index);
+
+        struct ThreadIndex {
+            unsigned int value = acquireThreadIndex();
+
+            ~ThreadIndex() {
+                releaseThreadIndex(value);
+            }
+        };
+
+        // A small number identifying the calling thread, reused after the thread exits.
+        inline unsigned int currentThreadIndex() {
+            static thread_local ThreadIndex index;
+            return index.value;
+        }
+    }
+
+    // Counts values (usually TSC deltas) in log-linear buckets, in the style of HdrHistogram.
+    // Values below 256 are counted exactly; larger values land in a bucket no wider than 1/128 of the value.
+    // record() never allocates, and it's safe to merge or query a histogram while one other thread records to it.
+    class LatencyHistogram {
+    public:
+        static constexpr int SUB_BUCKET_BITS = 8;
+        static constexpr uint64_t SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+        static constexpr uint64_t HALF_SUB_BUCKET_COUNT = SUB_BUCKET_COUNT / 2;
+        static constexpr size_t BUCKET_COUNT = SUB_BUCKET_COUNT + (64 - SUB_BUCKET_BITS) * HALF_SUB_BUCKET_COUNT;
+
+    private:
+        std::unique_ptr<uint64_t[]> counts;
+        uint64_t totalCount = 0;
+        uint64_t minimum = UINT64_MAX;
+        uint64_t maximum = 0;
+
+        // The counters are only ever written by the recording thread, so a relaxed load and store is enough
+        // (and unlike a fetch_add, doesn't need a locked instruction).
+        static void increase(uint64_t &counter, const uint64_t amount) {
+            std::atomic_ref atomicCounter(counter);
+            atomicCounter.store(atomicCounter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+
+        static uint64_t read(const uint64_t &counter) {
+            return std::atomic_ref(const_cast<uint64_t &>(counter)).load(std::memory_order_relaxed);
+        }
+
+    public:
+        LatencyHistogram();
+
+        LatencyHistogram(const LatencyHistogram &other);
+
+        LatencyHistogram(LatencyHistogram &&other) noexcept = default;
+
+        LatencyHistogram &operator=(const LatencyHistogram &other);
+
+        LatencyHistogram &operator=(LatencyHistogram &&other) noexcept = default;
+
+        static size_t getBucketIndex(const uint64_t value) {
+            if (value < SUB_BUCKET_COUNT)
+                return value;
+            const auto shift = std::bit_width(value) - SUB_BUCKET_BITS;
+            const auto subBucket = value >> shift;
+            return SUB_BUCKET_COUNT + (shift - 1) * HALF_SUB_BUCKET_COUNT + (subBucket - HALF_SUB_BUCKET_COUNT);
+        }
+
+        // Returns the smallest value that lands in the given bucket.
+        static uint64_t getBucketLowestValue(size_t index);
+
+        // Returns the largest value that lands in the given bucket.
+        static uint64_t getBucketHighestValue(size_t index);
+
+        void record(const uint64_t value, const uint64_t count = 1) {
+            increase(counts[getBucketIndex(value)], count);
+            increase(totalCount, count);
+            if (value < read(minimum))
+                std::atomic_ref(minimum).store(value, std::memory_order_relaxed);
+            if (value > read(maximum))
+                std::atomic_ref(maximum).store(value, std::memory_order_relaxed);
+        }
+
+        // Adds the other histogram's counts to this one's.
+        void merge(const LatencyHistogram &other);
+
+        void reset();
+
+        [[nodiscard]] uint64_t getCount() const {
+            return read(totalCount);
+        }
+
+        [[nodiscard]] uint64_t getCountInBucket(const size_t index) const {
+            return read(counts[index]);
+        }
+
+        // The exact smallest and largest recorded values. The minimum is UINT64_MAX if nothing was recorded.
+        [[nodiscard]] uint64_t getMinimum() const {
+            return read(minimum);
+        }
+
+        [[nodiscard]] uint64_t getMaximum() const {
+            return read(maximum);
+        }
+
+        [[nodiscard]] double getMean() const;
+
+        // Returns a value at or below which the given percentage (0 to 100) of recorded values lie,
+        // accurate to the width of its bucket. Returns 0 if nothing was recorded.
+        [[nodiscard]] uint64_t getValueAtPercentile(double percentile) const;
+
+        // Encodes the non-empty buckets as varints. Typically a few hundred bytes.
+        [[nodiscard]] std::vector<uint8_t> serialize() const;
+
+        // Throws std::invalid_argument if the data wasn't produced by serialize().
+        [[nodiscard]] static LatencyHistogram deserialize(const uint8_t *data, size_t size);
+    };
+
+    // A LatencyHistogram per recording thread, so that record() doesn't need any locked instructions
+    // and threads don't contend for cache lines. Queries merge the shards.
+    class ShardedLatencyHistogram {
+    public:
+        static constexpr unsigned int MAX_SHARDS = 256;
+
+    private:
+        std::unique_ptr<std::atomic<LatencyHistogram *>[]> shards;
+
+        LatencyHistogram &createShard(unsigned int index);
+
+    public:
+        ShardedLatencyHistogram();
+
+        ~ShardedLatencyHistogram();
+
+        ShardedLatencyHistogram(const ShardedLatencyHistogram &) = delete;
+
+        ShardedLatencyHistogram &operator=(const ShardedLatencyHistogram &) = delete;
+
+        // Returns the calling thread's shard. Only allocates the first time a thread records.
+        LatencyHistogram &getShard() {
+            // More than MAX_SHARDS live threads will share shards and may lose counts, but never corrupt them.
+            const auto index = detail::currentThreadIndex() % MAX_SHARDS;
+            auto *shard = shards[index].load(std::memory_order_acquire);
+            if (shard == nullptr) [[unlikely]]
+                return createShard(index);
+            return *shard;
+        }
+
+        void record(const uint64_t value, const uint64_t count = 1) {
+            getShard().record(value, count);
+        }
+
+        // Merges every shard into one histogram.
+        [[nodiscard]] LatencyHistogram snapshot() const;
+    };
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "timetools.h"
+
+namespace timetools {
+    struct JitterOptions {
+        // Empty to measure every online cpu this process may run on.
+        std::vector<int> cpus;
+        uint64_t durationNanoseconds = 1000000000;
+        // Gaps between consecutive TSC reads longer than this were time the thread didn't get, from an interrupt,
+        // an SMI or the kernel doing housekeeping.
+        uint64_t thresholdNanoseconds = 1000;
+        // SCHED_FIFO priority for the measuring threads, so that only what preempts everything shows up.
+        // 0 leaves them at normal priority. The kernel throttles realtime threads that run for longer than
+        // sched_rt_runtime_us out of every sched_rt_period_us (by default 950 ms a second), which would show up
+        // as a gap on every cpu, so longer runs are split into slices with a sleep between them that isn't counted.
+        int realtimePriority = 95;
+        // Gaps past this many per cpu are still counted in the histogram, but their timestamps aren't kept.
+        size_t maximumEventsPerCpu = 10000;
+    };
+
+    struct JitterEvent {
+        // When the gap started.
+        uint64_t tsc;
+        uint64_t nanoseconds;
+    };
+
+    struct CpuJitter {
+        int cpu;
+        // 0, or the error from pinning the thread to the cpu or raising its priority.
+        int error;
+        uint64_t durationNanoseconds;
+        // Every gap above the threshold, in nanoseconds.
+        LatencyHistogram gaps;
+        std::vector<JitterEvent> events;
+        uint64_t droppedEvents;
+        uint64_t stolenNanoseconds;
+
+        [[nodiscard]] double getStolenFraction() const {
+            return durationNanoseconds == 0
+                       ? 0
+                       : static_cast<double>(stolenNanoseconds) / static_cast<double>(durationNanoseconds);
+        }
+    };
+
+    struct JitterReport {
+        std::vector<CpuJitter> cpus;
+
+        // The cpus that were measured without error and never lost more than the given time at once, quietest
+        // first, as candidates for spinning Waiters.
+        [[nodiscard]] std::vector<int> getQuietCpus(uint64_t maximumGapNanoseconds) const;
+
+        // One line per cpu: gap count, p50, p99, p99.9 and maximum gap, and the share of the time lost.
+        void print(std::ostream &out) const;
+    };
+
+    namespace detail {
+        struct RealtimeSlicing {
+            // How long to spin before sleeping, or UINT64_MAX to spin for the whole run.
+            uint64_t sliceNanoseconds;
+            uint64_t sleepNanoseconds;
+        };
+
+        // Spins for 90% of the realtime runtime budget and sleeps the rest of each period. A negative runtime
+        // means realtime threads aren't throttled.
+        RealtimeSlicing getRealtimeSlicing(int64_t runtimeMicroseconds, int64_t periodMicroseconds);
+    }
+
+    // Spins a pinned thread on every selected cpu at once, each reading the TSC back to back and recording the gaps,
+    // in the manner of sysjitter. Takes the options' duration, plus calibrating any cpus that aren't yet.
+    [[nodiscard]] JitterReport measureJitter(TimerFactory &factory, const JitterOptions &options = {});
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <vector>
+
+#include "timetools.h"
+
+namespace timetools {
+    enum class ArrivalProcess {
+        Constant, // Evenly spaced
+        Poisson, // Exponentially distributed gaps, like independent clients
+    };
+
+    struct LoadOptions {
+        double requestsPerSecond = 10000;
+        uint64_t durationNanoseconds = 1000000000;
+        ArrivalProcess arrivals = ArrivalProcess::Constant;
+        // Send times in nanoseconds from the start, in order. If not empty, replayed instead of generating a schedule
+        // from the rate, duration and arrival process.
+        std::vector<uint64_t> trace;
+        // One sending thread pinned to each, taking every senders-th request. Empty for one sender on any cpu.
+        std::vector<int> cpus;
+        WaitStrategy strategy = WaitStrategy::Automatic;
+        uint64_t seed = 1;
+    };
+
+    struct LoadReport {
+        uint64_t requests;
+        // The trace's average rate when replaying one, or 0 if it sends everything at the same time.
+        double targetRequestsPerSecond;
+        // Requests over the time from the start to the last one completing.
+        double achievedRequestsPerSecond;
+        uint64_t elapsedNanoseconds;
+        // From each request's intended send time to its completion.
+        LatencyHistogram latencyNanoseconds;
+        // From each request's intended send time to when it was actually sent.
+        LatencyHistogram sendDelayNanoseconds;
+        // Nonzero if a sender couldn't be pinned to its cpu.
+        int error;
+
+        // Target and achieved rate, then p50, p99, p99.9 and maximum latency and send delay.
+        void print(std::ostream &out) const;
+    };
+
+    // Computes the intended send times, in nanoseconds from the start.
+    [[nodiscard]] std::vector<uint64_t> makeLoadSchedule(const LoadOptions &options);
+
+    // Sends requests on a fixed schedule, calling send with each request's index, which returns when the request
+    // has completed. Latency is measured from when the request should have been sent rather than from when it was,
+    // so that a stall in the system under test is charged to every request it held back, not only to the one that
+    // stalled. Senders start together at a StartBarrier deadline and wait for each send time with a Waiter.
+    [[nodiscard]] LoadReport generateLoad(TimerFactory &factory, const LoadOptions &options,
+                                          const std::function<void(uint64_t request)> &send);
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "timetools.h"
+
+namespace timetools {
+    // Makes the compiler assume the value is read, so that the code computing it can't be eliminated.
+    template<typename T>
+    inline void doNotOptimize(const T &value) {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    // Makes the compiler assume the value is read and modified, so it can't be hoisted out of a loop either.
+    template<typename T>
+    inline void doNotOptimize(T &value) {
+        asm volatile("" : "+r,m"(value) : : "memory");
+    }
+
+    // Makes the compiler assume all memory is read and written, so that stores before it can't be elided.
+    inline void clobberMemory() {
+        asm volatile("" : : : "memory");
+    }
+
+    struct MeasureOptions {
+        // The batch size is doubled until a batch takes at least this long, so that the clock's resolution
+        // and the stopwatch's overhead are negligible next to it.
+        uint64_t minimumBatchNanoseconds = 20000;
+        // How long to keep running the callable before measuring, to fill caches and predictors
+        // and let the core reach its working frequency.
+        uint64_t warmupNanoseconds = 10000000;
+        unsigned int batches = 101;
+        // Batches slower than the median by more than this many median absolute deviations are assumed to have
+        // been interrupted and are left out.
+        double outlierDeviations = 5;
+        uint64_t maximumBatchSize = 1ull << 32;
+    };
+
+    struct MeasureResult {
+        uint64_t batchSize;
+        unsigned int keptBatches;
+        unsigned int rejectedBatches;
+        // From the median batch.
+        double nanosecondsPerOperation;
+        double ticksPerOperation;
+        // From the fastest batch.
+        double minimumNanosecondsPerOperation;
+    };
+
+    namespace detail {
+        template<typename Stopwatch, typename Callable>
+        uint64_t timeBatch(Stopwatch &stopwatch, Callable &callable, const uint64_t batchSize) {
+            stopwatch.reset();
+            stopwatch.start();
+            for (uint64_t i = 0; i < batchSize; ++i)
+                callable();
+            stopwatch.stop();
+            return stopwatch.getElapsedTicks();
+        }
+    }
+
+    // Times batches of calls to the callable, which should use doNotOptimize() on its result.
+    // The stopwatch's own overhead is subtracted when the factory compensates for it, which it does by default.
+    template<typename Callable>
+    MeasureResult measure(TimerFactory &factory, Callable &&callable, const MeasureOptions &options = {}) {
+        // Doesn't assert if the thread migrates between batches.
+        auto stopwatch = factory.createStopwatch<RdtscClock, LoadFence>();
+
+        // Finding the batch size doubles as the start of the warmup.
+        uint64_t batchSize = 1;
+        uint64_t warmedUpTicks = 0;
+        while (batchSize < options.maximumBatchSize) {
+            const auto ticks = detail::timeBatch(stopwatch, callable, batchSize);
+            warmedUpTicks += ticks;
+            if (stopwatch.toNanoseconds(ticks) >= options.minimumBatchNanoseconds)
+                break;
+            batchSize *= 2;
+        }
+        while (stopwatch.toNanoseconds(warmedUpTicks) < options.warmupNanoseconds)
+            warmedUpTicks += detail::timeBatch(stopwatch, callable, batchSize);
+
+        std::vector<uint64_t> batchTicks(std::max(1u, options.batches));
+        for (auto &ticks: batchTicks)
+            ticks = detail::timeBatch(stopwatch, callable, batchSize);
+        std::sort(batchTicks.begin(), batchTicks.end());
+
+        // Interrupts only ever make a batch slower, so only reject from the top.
+        const auto median = batchTicks[batchTicks.size() / 2];
+        std::vector<uint64_t> deviations(batchTicks.size());
+        std::transform(batchTicks.begin(), batchTicks.end(), deviations.begin(), [median](const uint64_t ticks) {
+            return ticks > median ? ticks - median : median - ticks;
+        });
+        std::nth_element(deviations.begin(), deviations.begin() + deviations.size() / 2, deviations.end());
+        const auto limit = median + options.outlierDeviations * static_cast<double>(
+                               std::max<uint64_t>(deviations[deviations.size() / 2], 1));
+        const auto kept = std::upper_bound(batchTicks.begin(), batchTicks.end(), limit,
+                                           [](const double value, const uint64_t ticks) { return value < ticks; })
+                          - batchTicks.begin();
+
+        MeasureResult result;
+        result.batchSize = batchSize;
+        result.keptBatches = kept;
+        result.rejectedBatches = batchTicks.size() - kept;
+        const auto keptMedian = batchTicks[kept / 2];
+        const auto size = static_cast<double>(batchSize);
+        result.ticksPerOperation = static_cast<double>(keptMedian) / size;
+        result.nanosecondsPerOperation = static_cast<double>(stopwatch.toNanoseconds(keptMedian)) / size;
+        result.minimumNanosecondsPerOperation = static_cast<double>(stopwatch.toNanoseconds(batchTicks.front()))
+                                                / size;
+        return result;
+    }
+}
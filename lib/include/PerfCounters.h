@@ -0,0 +1,99 @@
+#pragma once
+#include <cstdint>
+#include <linux/perf_event.h>
+#include <string>
+#include <vector>
+
+#include "timetools.h"
+
+namespace timetools {
+    // A perf event, as perf_event_open's type and config fields.
+    struct PerfEventSpec {
+        std::string name;
+        uint32_t type;
+        uint64_t config;
+    };
+
+    namespace PerfEvents {
+        inline const PerfEventSpec CYCLES{"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES};
+        inline const PerfEventSpec INSTRUCTIONS{"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS};
+        inline const PerfEventSpec LLC_MISSES{"llc-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES};
+        inline const PerfEventSpec BRANCH_MISSES{"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES};
+        inline const PerfEventSpec CONTEXT_SWITCHES{
+            "context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES
+        };
+        inline const PerfEventSpec PAGE_FAULTS{"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS};
+    }
+
+    // Cycles, instructions, LLC misses, branch misses, context switches and page faults.
+    [[nodiscard]] std::vector<PerfEventSpec> getDefaultPerfEvents();
+
+    struct CounterReading {
+        std::string name;
+        // False if the event couldn't be opened, for example because there's no PMU or perf is restricted.
+        bool available;
+        uint64_t count;
+        double perOperation;
+    };
+
+    struct CounterReport {
+        uint64_t elapsedNanoseconds;
+        double nanosecondsPerOperation;
+        // NaN unless both cycles and instructions were counted.
+        double instructionsPerCycle;
+        std::vector<CounterReading> counters;
+    };
+
+    // A Stopwatch that also counts perf events for the thread that creates it, reading them in the same
+    // start/stop bracket as the TSC. Hardware counters are read with rdpmc when the kernel allows it, and with
+    // read() otherwise. Events that can't be opened are reported as unavailable rather than failing, so the
+    // stopwatch still works, timing only, where perf is restricted.
+    class CounterStopwatch {
+        struct Counter {
+            PerfEventSpec spec;
+            int fd = -1;
+            perf_event_mmap_page *page = nullptr;
+            uint64_t startValue = 0;
+            uint64_t total = 0;
+        };
+
+        Stopwatch<> stopwatch;
+        std::vector<Counter> counters;
+
+        static uint64_t readCounter(const Counter &counter);
+
+        void readAll(bool starting);
+
+    public:
+        explicit CounterStopwatch(TimerFactory &factory,
+                                  const std::vector<PerfEventSpec> &events = getDefaultPerfEvents());
+
+        ~CounterStopwatch();
+
+        CounterStopwatch(const CounterStopwatch &) = delete;
+
+        CounterStopwatch &operator=(const CounterStopwatch &) = delete;
+
+        void start() {
+            readAll(true);
+            stopwatch.start();
+        }
+
+        void stop() {
+            stopwatch.stop();
+            readAll(false);
+        }
+
+        void reset();
+
+        [[nodiscard]] uint64_t getElapsedNanoseconds() const {
+            return stopwatch.getElapsedNanoseconds();
+        }
+
+        // Whether any event could be opened.
+        [[nodiscard]] bool hasCounters() const;
+
+        // Totals since the last reset, divided by the given number of operations.
+        [[nodiscard]] CounterReport report(uint64_t operations = 1) const;
+    };
+}
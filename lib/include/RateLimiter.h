@@ -0,0 +1,124 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <immintrin.h>
+#include <memory>
+#include <vector>
+
+#include "timetools.h"
+
+namespace timetools {
+    // A token bucket shared by any number of threads, kept as the generic cell rate algorithm: its whole state is
+    // the time, in TSC ticks, at which the bucket will next be full, in one atomic word updated by compare-and-swap.
+    // Checking it costs one rdtsc and, when tokens are granted, one CAS; refusals don't write.
+    // Times are kept to 1/16 of a tick from when the limiter was created, which lasts over seven years at 5 GHz.
+    class RateLimiter {
+        static constexpr int FRACTION_BITS = 4;
+
+        Waiter waiter;
+        uint64_t epochTsc;
+        uint64_t burst;
+        uint64_t intervalTsc_shl4; // Ticks per token * 2^4
+        uint64_t capacityTsc_shl4; // Ticks to refill the whole burst * 2^4
+        // When the bucket will be full again. How far this is ahead of now is what's been taken from it.
+        alignas(64) std::atomic<uint64_t> fullAtTsc_shl4 = 0;
+
+        [[nodiscard]] uint64_t getNow_shl4() const {
+            return (__rdtsc() - epochTsc) << FRACTION_BITS;
+        }
+
+        // Takes the tokens if the bucket has them, or unconditionally if waiting, and returns when the bucket held
+        // enough, or UINT64_MAX if it doesn't yet and it isn't waiting.
+        template<bool WAIT>
+        uint64_t take(const uint64_t tokens, const uint64_t now) {
+            const auto cost = tokens * intervalTsc_shl4;
+            auto fullAt = fullAtTsc_shl4.load(std::memory_order_relaxed);
+            while (true) {
+                const auto next = std::max(fullAt, now) + cost;
+                if (!WAIT && next - now > capacityTsc_shl4)
+                    return UINT64_MAX;
+                if (fullAtTsc_shl4.compare_exchange_weak(fullAt, next, std::memory_order_relaxed))
+                    return next - now > capacityTsc_shl4 ? next - capacityTsc_shl4 : now;
+            }
+        }
+
+    public:
+        // Allows tokensPerSecond on average, and up to burst at once after a quiet spell. The bucket starts full.
+        // Throws std::invalid_argument if either is not positive, or if the burst takes longer than a year to refill.
+        RateLimiter(TimerFactory &factory, double tokensPerSecond, uint64_t burst,
+                    WaitStrategy strategy = WaitStrategy::Automatic);
+
+        // Takes the tokens if they're available now. Never succeeds for more than the burst.
+        bool tryAcquire(const uint64_t tokens = 1) {
+            if (tokens > burst) [[unlikely]]
+                return false;
+            return take<false>(tokens, getNow_shl4()) != UINT64_MAX;
+        }
+
+        // Takes the tokens, using the waiter to wait for them if they aren't available yet. Threads waiting at once
+        // are served in the order they called. Returns false at once if the tokens are more than the burst.
+        bool waitFor(const uint64_t tokens = 1) {
+            if (tokens > burst) [[unlikely]]
+                return false;
+            const auto now = getNow_shl4();
+            if (const auto grantedAt = take<true>(tokens, now); grantedAt > now)
+                waiter.waitUntilTsc(epochTsc + (grantedAt >> FRACTION_BITS));
+            return true;
+        }
+
+        // Tokens that tryAcquire() could take right now.
+        [[nodiscard]] uint64_t getAvailableTokens() const {
+            const auto now = getNow_shl4();
+            const auto fullAt = fullAtTsc_shl4.load(std::memory_order_relaxed);
+            const auto debt = fullAt > now ? fullAt - now : 0;
+            return (capacityTsc_shl4 - std::min(debt, capacityTsc_shl4)) / intervalTsc_shl4;
+        }
+
+        [[nodiscard]] uint64_t getBurst() const {
+            return burst;
+        }
+    };
+
+    // Splits one rate limit across several RateLimiters, so that threads hammering the same key mostly update
+    // their own cache line. A thread takes from its own shard first and only then tries the others, so the total
+    // rate and burst are kept while any shard has tokens. Each shard has its share of the burst, which limits
+    // a single call to getShardBurst() tokens.
+    class ShardedRateLimiter {
+        std::vector<std::unique_ptr<RateLimiter>> shards;
+
+        [[nodiscard]] size_t getOwnShard() const {
+            return detail::currentThreadIndex() % shards.size();
+        }
+
+    public:
+        // Uses no more shards than the burst, so that each has at least one token.
+        ShardedRateLimiter(TimerFactory &factory, double tokensPerSecond, uint64_t burst, unsigned int shardCount,
+                           WaitStrategy strategy = WaitStrategy::Automatic);
+
+        bool tryAcquire(const uint64_t tokens = 1) {
+            const auto own = getOwnShard();
+            for (size_t i = 0; i < shards.size(); ++i) {
+                if (shards[(own + i) % shards.size()]->tryAcquire(tokens))
+                    return true;
+            }
+            return false;
+        }
+
+        // Waits on the calling thread's shard if no shard has the tokens now.
+        bool waitFor(const uint64_t tokens = 1) {
+            return tryAcquire(tokens) || shards[getOwnShard()]->waitFor(tokens);
+        }
+
+        [[nodiscard]] uint64_t getAvailableTokens() const;
+
+        // The most tokens one call can take: the smallest shard's burst.
+        [[nodiscard]] uint64_t getShardBurst() const {
+            return shards.back()->getBurst();
+        }
+
+        [[nodiscard]] size_t getShardCount() const {
+            return shards.size();
+        }
+    };
+}
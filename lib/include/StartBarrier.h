@@ -0,0 +1,70 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "timetools.h"
+
+namespace timetools {
+    struct BarrierRelease {
+        uint64_t deadlineTsc;
+        // Between the earliest and the latest participant leaving the barrier.
+        uint64_t skewNanoseconds;
+        // How long after the deadline the latest participant left.
+        uint64_t maximumLatenessNanoseconds;
+    };
+
+    // A spin barrier for a fixed number of threads that releases them all at once: the last to arrive picks a TSC
+    // deadline a little in the future, and every participant waits for it with a calibrated Waiter rather than
+    // leaving whenever it sees the others have arrived. It can be reused, to run the phases of a benchmark in
+    // lock step.
+    // How far apart the participants actually left is measured each round, converting each one's lateness at its
+    // own core's rate and correcting for the cores' TSC offsets when the factory has measured them.
+    class StartBarrier {
+        struct alignas(64) Departure {
+            uint64_t tsc = 0;
+            unsigned int cpu = 0;
+        };
+
+        TimerFactory &factory;
+        Waiter waiter;
+        unsigned int participants;
+        uint64_t leadTsc;
+        uint64_t fallbackFrequencyHz;
+        std::shared_ptr<const TscOffsetTable> tscOffsets;
+        std::unique_ptr<Departure[]> departures;
+        LatencyHistogram skews;
+        BarrierRelease lastRelease{};
+        uint64_t deadlineTsc = 0;
+        uint64_t measuredRound = 0;
+        alignas(64) std::atomic<unsigned int> arrived = 0;
+        alignas(64) std::atomic<uint64_t> round = 0;
+
+        // Measures the last round released, unless it has been already. Called by the last to arrive, since by then
+        // every participant has left the previous round.
+        void measureLastRound();
+
+    public:
+        // The lead is how far ahead the deadline is set: long enough for every spinning participant to see it.
+        // Throws std::invalid_argument if there are no participants.
+        StartBarrier(TimerFactory &factory, unsigned int participants, uint64_t leadNanoseconds = 20000,
+                     WaitStrategy strategy = WaitStrategy::Automatic);
+
+        StartBarrier(const StartBarrier &) = delete;
+
+        StartBarrier &operator=(const StartBarrier &) = delete;
+
+        // Waits until every participant has arrived, then until the deadline, and returns the round's deadline.
+        uint64_t arriveAndWait();
+
+        // The last round released. Call it when no round is in progress, such as after joining the participants'
+        // threads.
+        [[nodiscard]] BarrierRelease getLastRelease();
+
+        // The skew of every round so far, in nanoseconds. Like getLastRelease(), only call it between rounds.
+        [[nodiscard]] const LatencyHistogram &getSkews() {
+            measureLastRound();
+            return skews;
+        }
+    };
+}
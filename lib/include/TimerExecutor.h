@@ -0,0 +1,200 @@
+#pragma once
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <immintrin.h>
+#include <memory>
+#include <thread>
+
+#include "TscConversion.h"
+
+namespace timetools {
+    class TimerFactory;
+
+    struct TimerExecutorOptions {
+        // The core to run the executor thread on, or -1 to leave it unpinned.
+        int cpu = -1;
+        // SCHED_FIFO priority for the executor thread, or 0 to leave its scheduling alone.
+        int realtimePriority = 0;
+        // The most timers that can be pending at once. Their nodes are allocated up front.
+        size_t maxTimers = 1 << 18;
+        // Capacity of the submission queue. Must be a power of two.
+        size_t queueCapacity = 1 << 16;
+        // Each slot of the innermost wheel spans 2^slotTscShift TSC ticks.
+        unsigned int slotTscShift = 8;
+    };
+
+    using TimerCallback = void (*)(void *context);
+
+    // Runs callbacks at TSC deadlines from a thread that spins on its own core. Any thread may schedule timers;
+    // they pass through a lock-free queue to the executor thread, which files them in a hierarchical timer wheel.
+    // Once constructed, scheduling and firing timers never allocates.
+    class TimerExecutor {
+    public:
+        static constexpr unsigned int LEVEL_BITS = 8;
+        static constexpr unsigned int SLOTS_PER_LEVEL = 1 << LEVEL_BITS;
+        static constexpr unsigned int LEVEL_COUNT = 4;
+
+        // Suspends a coroutine until a deadline, then resumes it on the executor thread.
+        class Awaitable {
+            TimerExecutor &executor;
+            uint64_t deadlineTsc;
+
+            static void resume(void *address) {
+                std::coroutine_handle<>::from_address(address).resume();
+            }
+
+        public:
+            Awaitable(TimerExecutor &executor, const uint64_t deadlineTsc)
+                : executor(executor), deadlineTsc(deadlineTsc) {
+            }
+
+            [[nodiscard]] bool await_ready() const {
+                return __rdtsc() >= deadlineTsc;
+            }
+
+            bool await_suspend(const std::coroutine_handle<> handle) const {
+                if (executor.scheduleAt(deadlineTsc, &resume, handle.address()))
+                    return true;
+                if (!executor.isExecutorThread()) {
+                    // There's no way to fail an await, so wait for the executor thread to make room.
+                    while (!executor.scheduleAt(deadlineTsc, &resume, handle.address()))
+                        _mm_pause();
+                    return true;
+                }
+                // Every timer is taken and the executor thread is the only one that can free them, so wait out the
+                // deadline here and carry on without suspending.
+                while (__rdtsc() < deadlineTsc)
+                    _mm_pause();
+                return false;
+            }
+
+            void await_resume() const {
+            }
+        };
+
+    private:
+        struct TimerNode {
+            uint64_t deadlineTsc;
+            TimerCallback callback;
+            void *context;
+            TimerNode *next;
+        };
+
+        // A cell of a bounded multi-producer queue, after Dmitry Vyukov's. The sequence says whose turn it is.
+        struct Submission {
+            std::atomic<uint64_t> sequence;
+            uint64_t deadlineTsc;
+            TimerCallback callback;
+            void *context;
+        };
+
+        TimerExecutorOptions options;
+        TscConversion conversion{1 << 25};
+
+        std::unique_ptr<Submission[]> queue;
+        uint64_t queueMask;
+        alignas(64) std::atomic<uint64_t> enqueuePosition = 0;
+
+        // Everything below here belongs to the executor thread.
+        alignas(64) uint64_t dequeuePosition = 0;
+        std::unique_ptr<TimerNode[]> arena;
+        TimerNode *freeNodes = nullptr;
+        // LEVEL_COUNT wheels of SLOTS_PER_LEVEL lists. A timer is filed at the level of the highest digit
+        // in which its slot differs from currentSlot, in the slot given by its own digit at that level.
+        std::unique_ptr<TimerNode *[]> wheels;
+        uint64_t currentSlot = 0;
+        uint64_t pendingCount = 0;
+
+        std::atomic<uint64_t> firedCount = 0;
+        std::atomic<bool> stopping = false;
+        std::thread thread;
+
+        static thread_local const TimerExecutor *runningExecutor;
+
+        TimerNode *&getSlot(const unsigned int level, const uint64_t slot) {
+            return wheels[level * SLOTS_PER_LEVEL + (slot >> (level * LEVEL_BITS) & (SLOTS_PER_LEVEL - 1))];
+        }
+
+        void run();
+
+        void drainSubmissions();
+
+        void insert(TimerNode *node);
+
+        void advance(uint64_t nowTsc);
+
+        // Fires the innermost wheel's current slot's timers that are due by the given time.
+        void fireDue(uint64_t nowTsc);
+
+        // Files a timer from the executor thread, if there's a free node.
+        bool scheduleDirectly(uint64_t deadlineTsc, TimerCallback callback, void *context);
+
+    public:
+        // Starts the executor thread. Throws std::system_error if it can't be given the requested core or priority.
+        explicit TimerExecutor(TimerFactory &factory, const TimerExecutorOptions &options = {});
+
+        // Stops the executor thread. Timers that haven't fired yet never will.
+        ~TimerExecutor();
+
+        TimerExecutor(const TimerExecutor &) = delete;
+
+        TimerExecutor &operator=(const TimerExecutor &) = delete;
+
+        // Calls callback(context) on the executor thread once the TSC reaches the deadline.
+        // Safe to call from any thread, including from a callback, which files the timer in the wheel directly
+        // rather than through the queue. Returns false if the queue is full, or from a callback, if every timer
+        // node is in use and the queue is full.
+        bool scheduleAt(const uint64_t deadlineTsc, const TimerCallback callback, void *context) {
+            if (isExecutorThread() && scheduleDirectly(deadlineTsc, callback, context))
+                return true;
+            auto position = enqueuePosition.load(std::memory_order_relaxed);
+            Submission *cell;
+            while (true) {
+                cell = &queue[position & queueMask];
+                const auto sequence = cell->sequence.load(std::memory_order_acquire);
+                const auto difference = static_cast<int64_t>(sequence - position);
+                if (difference == 0) {
+                    if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                        break;
+                } else if (difference < 0) {
+                    return false;
+                } else {
+                    position = enqueuePosition.load(std::memory_order_relaxed);
+                }
+            }
+            cell->deadlineTsc = deadlineTsc;
+            cell->callback = callback;
+            cell->context = context;
+            cell->sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool scheduleAfter(const uint64_t nanoseconds, const TimerCallback callback, void *context) {
+            return scheduleAt(__rdtsc() + nanosecondsToTsc(nanoseconds), callback, context);
+        }
+
+        // co_await executor.after(ns) resumes the coroutine on the executor thread about ns nanoseconds later.
+        [[nodiscard]] Awaitable after(const uint64_t nanoseconds) {
+            return {*this, __rdtsc() + nanosecondsToTsc(nanoseconds)};
+        }
+
+        [[nodiscard]] Awaitable at(const uint64_t deadlineTsc) {
+            return {*this, deadlineTsc};
+        }
+
+        [[nodiscard]] uint64_t nanosecondsToTsc(const uint64_t nanoseconds) const {
+            return conversion.toTicks(nanoseconds);
+        }
+
+        // Whether the calling thread is this executor's, as it is in callbacks and resumed coroutines.
+        [[nodiscard]] bool isExecutorThread() const {
+            return runningExecutor == this;
+        }
+
+        // Timers whose callbacks have returned.
+        [[nodiscard]] uint64_t getFiredCount() const {
+            return firedCount.load(std::memory_order_acquire);
+        }
+    };
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <string>
+#include <vector>
+
+namespace timetools {
+    struct CpuDescription {
+        int cpu;
+        int package;
+        // -1 if the kernel wasn't built with NUMA support.
+        int numaNode;
+        // The lowest-numbered cpu sharing this one's last-level cache, which identifies the cache.
+        int cacheDomain;
+        // The lowest-numbered SMT sibling, which identifies the physical core.
+        int core;
+        std::vector<int> smtSiblings;
+        // Listed in isolcpus, so the scheduler won't put other threads on it.
+        bool isolated;
+        // Listed in nohz_full, so the scheduler tick stops while one thread runs on it.
+        bool nohzFull;
+    };
+
+    struct CpuTopology {
+        std::vector<CpuDescription> cpus;
+
+        // Returns null if the cpu isn't in the topology.
+        [[nodiscard]] const CpuDescription *find(int cpu) const;
+    };
+
+    // Reads the topology of the online cpus this process is allowed to run on from sysfs.
+    [[nodiscard]] CpuTopology getCpuTopology();
+
+    enum class ThreadRole {
+        // Busy-waits, such as a spinning Waiter. Gets a physical core to itself, because it takes most of the
+        // core's issue slots from an SMT sibling.
+        Spinning,
+        // Runs a Pacer or TimerExecutor loop. Placed like Spinning, since it also spins close to its deadlines.
+        Pacer,
+        // Latency-sensitive but doesn't spin. Gets a core to itself where one is left, but may share one with
+        // another hot worker.
+        HotWorker,
+        // Everything else. Kept off isolated cpus and off the cores of the other roles, sharing a hot worker's core
+        // only when there's nowhere else, and packed onto cores with other background threads to leave whole
+        // cores free.
+        Background,
+    };
+
+    struct ThreadRequest {
+        ThreadRole role;
+        // Threads with the same non-negative group exchange data, so they're kept on one last-level cache.
+        int group = -1;
+    };
+
+    struct ThreadPlacement {
+        // -1 if there's nowhere left that wouldn't slow down another thread, in which case leave it unpinned.
+        int cpu;
+        // Whether another placed thread runs on an SMT sibling of this cpu.
+        bool sharesCore;
+    };
+
+    // Chooses a cpu for each thread, in the same order, to pass to setThisThreadAffinity(). Prefers isolated cpus
+    // for every role but Background, avoids the core handling cpu 0's housekeeping, and never puts anything on an SMT
+    // sibling of a Spinning or Pacer thread.
+    [[nodiscard]] std::vector<ThreadPlacement> planThreadPlacement(const CpuTopology &topology,
+                                                                   const std::vector<ThreadRequest> &threads);
+
+    namespace detail {
+        // Reads the given cpus' topology from a sysfs cpu directory, normally /sys/devices/system/cpu.
+        [[nodiscard]] CpuTopology readCpuTopology(const std::string &cpuDirectory, const std::vector<int> &cpus);
+    }
+}
@@ -0,0 +1,174 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <immintrin.h>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Histogram.h"
+
+namespace timetools {
+    class TimerFactory;
+
+    enum class TracePhase : uint8_t {
+        Begin,
+        End,
+        Instant,
+        Counter,
+    };
+
+    struct TraceRecord {
+        uint64_t tsc;
+        uint64_t payload;
+        uint32_t cpu; // TSC_AUX, as returned by rdtscp
+        uint32_t thread; // Kernel thread id
+        uint16_t eventId;
+        TracePhase phase;
+        uint8_t reserved[5];
+    };
+
+    static_assert(sizeof(TraceRecord) == 32);
+
+    struct TracerOptions {
+        // Capacity of each thread's ring buffer. Must be a power of two. Records are dropped while a ring is full.
+        size_t recordsPerThread = 1 << 16;
+        // How much the output file grows by when it fills up.
+        size_t fileGrowthRecords = 1 << 20;
+        // How often the background thread moves records from the rings to the file.
+        uint64_t drainIntervalNanoseconds = 1000000;
+    };
+
+    // Records timestamped events into per-thread rings with a single rdtscp, and streams them to a binary file
+    // from a background thread. Use convertTraceToChromeJson() to turn the file into something Perfetto can show.
+    class Tracer {
+    public:
+        static constexpr unsigned int MAX_THREADS = 256;
+
+    private:
+        // A single-producer, single-consumer ring. The owning thread advances head; the drainer advances tail.
+        struct alignas(64) ThreadBuffer {
+            TraceRecord *records;
+            size_t mask;
+            alignas(64) std::atomic<uint64_t> head = 0;
+            uint64_t cachedTail = 0;
+            std::atomic<uint64_t> dropped = 0;
+            alignas(64) std::atomic<uint64_t> tail = 0;
+        };
+
+        TimerFactory &factory;
+        TracerOptions options;
+        std::unique_ptr<std::atomic<ThreadBuffer *>[]> buffers;
+        // Records from threads that didn't get a ring.
+        std::atomic<uint64_t> unbufferedDropped = 0;
+        std::mutex eventNamesMutex;
+        std::vector<std::string> eventNames;
+
+        int fd = -1;
+        uint8_t *mapping = nullptr;
+        size_t mappingSize = 0;
+        uint64_t writtenRecords = 0;
+        bool closed = false;
+
+        std::mutex stopMutex;
+        std::condition_variable stopCondition;
+        bool stopping = false;
+        std::thread drainer;
+
+        static uint32_t currentThreadId() {
+            static thread_local uint32_t threadId = queryThreadId();
+            return threadId;
+        }
+
+        static uint32_t queryThreadId();
+
+        ThreadBuffer &createBuffer(unsigned int index);
+
+        // Returns null for threads past the first MAX_THREADS alive at once, which would otherwise share a ring
+        // that only one thread may write.
+        ThreadBuffer *getBuffer() {
+            const auto index = detail::currentThreadIndex();
+            if (index >= MAX_THREADS) [[unlikely]]
+                return nullptr;
+            auto *buffer = buffers[index].load(std::memory_order_acquire);
+            if (buffer == nullptr) [[unlikely]]
+                return &createBuffer(index);
+            return buffer;
+        }
+
+        void drainLoop();
+
+        // Moves everything currently in the rings to the file. Only called by one thread at a time.
+        void drain();
+
+        bool reserveFileSpace(uint64_t records);
+
+    public:
+        // Creates (or truncates) the trace file at the given path and starts the background thread.
+        // Throws std::system_error if the file can't be created.
+        Tracer(TimerFactory &factory, const std::string &path, const TracerOptions &options = {});
+
+        ~Tracer();
+
+        Tracer(const Tracer &) = delete;
+
+        Tracer &operator=(const Tracer &) = delete;
+
+        // Returns the id to record the named event with. Registering the same name twice returns the same id.
+        uint16_t registerEvent(const std::string &name);
+
+        void record(const uint16_t eventId, const TracePhase phase, const uint64_t payload) {
+            auto *bufferPointer = getBuffer();
+            if (bufferPointer == nullptr) [[unlikely]] {
+                unbufferedDropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            auto &buffer = *bufferPointer;
+            const auto head = buffer.head.load(std::memory_order_relaxed);
+            if (head - buffer.cachedTail > buffer.mask) [[unlikely]] {
+                buffer.cachedTail = buffer.tail.load(std::memory_order_acquire);
+                if (head - buffer.cachedTail > buffer.mask) {
+                    buffer.dropped.store(buffer.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                    return;
+                }
+            }
+            auto &record = buffer.records[head & buffer.mask];
+            record.tsc = __rdtscp(&record.cpu);
+            record.payload = payload;
+            record.thread = currentThreadId();
+            record.eventId = eventId;
+            record.phase = phase;
+            buffer.head.store(head + 1, std::memory_order_release);
+        }
+
+        void begin(const uint16_t eventId, const uint64_t payload = 0) {
+            record(eventId, TracePhase::Begin, payload);
+        }
+
+        void end(const uint16_t eventId, const uint64_t payload = 0) {
+            record(eventId, TracePhase::End, payload);
+        }
+
+        void instant(const uint16_t eventId, const uint64_t payload = 0) {
+            record(eventId, TracePhase::Instant, payload);
+        }
+
+        void counter(const uint16_t eventId, const uint64_t value) {
+            record(eventId, TracePhase::Counter, value);
+        }
+
+        // Records lost because a thread's ring was full, or because more than MAX_THREADS threads were recording.
+        [[nodiscard]] uint64_t getDroppedCount() const;
+
+        // Stops the background thread, drains the rings and finishes the file. Called by the destructor.
+        void close();
+    };
+
+    // Converts a file written by Tracer into the Chrome trace event JSON format, using the per-core TSC rates
+    // stored in the file. Returns 0 on success or an errno value.
+    int convertTraceToChromeJson(const std::string &tracePath, std::ostream &out);
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace timetools {
+    // Converts between TSC ticks and nanoseconds at a fixed rate, as (value * multiplier) >> shift with a 128-bit
+    // product and a multiplier normalized to use all 64 bits. The multiplier is the rate rounded to within 2^-64 of
+    // itself, so results are within one of the exact conversion over the whole 64-bit range, and saturate rather
+    // than wrap if the result doesn't fit.
+    class TscConversion {
+        uint64_t nanosecondsMultiplier;
+        uint64_t ticksMultiplier;
+        unsigned int nanosecondsShift;
+        unsigned int ticksShift;
+
+        TscConversion() = default;
+
+        [[nodiscard]] static uint64_t apply(const uint64_t value, const uint64_t multiplier, const unsigned int shift) {
+            const auto result = (static_cast<unsigned __int128>(value) * multiplier) >> shift;
+            return result >> 64 != 0 ? UINT64_MAX : static_cast<uint64_t>(result);
+        }
+
+    public:
+        // From the rate the factory keeps for each core: TSC ticks per nanosecond * 2^25.
+        explicit TscConversion(uint64_t tscPerNanosecond_shl25);
+
+        [[nodiscard]] static TscConversion fromFrequencyHz(uint64_t frequencyHz);
+
+        [[nodiscard]] uint64_t toNanoseconds(const uint64_t ticks) const {
+            return apply(ticks, nanosecondsMultiplier, nanosecondsShift);
+        }
+
+        [[nodiscard]] uint64_t toTicks(const uint64_t nanoseconds) const {
+            return apply(nanoseconds, ticksMultiplier, ticksShift);
+        }
+
+        // Converts count tick deltas, with AVX-512 or AVX2 where the CPU has them. Gives the same results as the
+        // scalar overload. The arrays may be the same.
+        void toNanoseconds(const uint64_t *ticks, uint64_t *nanoseconds, size_t count) const;
+    };
+}
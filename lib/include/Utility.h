@@ -1,7 +1,56 @@
 #pragma once
+#include <atomic>
 #include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 namespace timetools {
     namespace detail {
-        uint64_t estimateTscFrequencyHz();
+        // Parses a kernel cpu list such as "0-3,8,10-11".
+        std::vector<int> parseCpuList(const std::string &list);
+
+        // Returns one more than the highest cpu number the kernel could ever bring online.
+        unsigned int getPossibleCpuCount();
+
+        // Returns the cpus that are online and that this process is allowed to run on.
+        std::vector<int> getOnlineCpus();
+
+        // Whether CPUID leaf 15H enumerates the TSC/crystal ratio and the crystal frequency.
+        bool hasGoodCpuTimer();
+
+        // Calibrated TSC frequencies shared by every process on the host through a file, usually in /dev/shm.
+        // Entries are only trusted while the CPU model, microcode revision and boot id match the ones they were made
+        // under, and only from a file owned by this user or root that nobody else can write.
+        class CalibrationCache {
+            struct Key;
+            struct Header;
+
+            std::string path;
+            std::unique_ptr<Key> key;
+            // Read-only view of the file, or null if it doesn't exist or is stale.
+            std::atomic<const Header *> mapping = nullptr;
+            size_t mappingSize = 0;
+            std::mutex storeMutex;
+
+            static Key currentKey();
+
+            void mapReadOnly();
+
+        public:
+            explicit CalibrationCache(std::string path);
+
+            ~CalibrationCache();
+
+            CalibrationCache(const CalibrationCache &) = delete;
+
+            CalibrationCache &operator=(const CalibrationCache &) = delete;
+
+            // Returns the cached TSC frequency in Hz for the given cpu, or 0 if there isn't one.
+            [[nodiscard]] uint64_t lookup(unsigned int cpu) const;
+
+            // Records the TSC frequency for the given cpu, recreating the file if it's missing or stale.
+            void store(unsigned int cpu, uint64_t frequencyHz);
+        };
     }
 }
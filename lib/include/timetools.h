@@ -1,63 +1,468 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
 #include <cstdint>
+#include <ctime>
+#include <immintrin.h>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "FastClock.h"
+#include "Histogram.h"
+#include "TimerExecutor.h"
+#include "Tracer.h"
+#include "TscConversion.h"
 
 namespace timetools {
     int setThisThreadAffinity(int cpu);
 
     int setThisThreadFifoRealtimePriority(int priority);
 
+    // Where a TSC frequency estimate came from, from most to least trustworthy.
+    enum class TscFrequencySource {
+        CpuidCrystalRatio, // CPUID leaves 15H/16H
+        Kernel, // The kernel's tsc_khz, from sysfs or the hypervisor's timing leaf
+        Regression, // A short fit against CLOCK_MONOTONIC_RAW
+    };
+
+    struct TscFrequencyEstimate {
+        uint64_t frequencyHz;
+        TscFrequencySource source;
+        // Half-width of the 95% confidence interval, in parts per million of frequencyHz.
+        double uncertaintyPpm;
+    };
+
+    // Tries each source in turn and returns the first that's available. Takes at most a few tens of milliseconds.
+    [[nodiscard]] TscFrequencyEstimate estimateTscFrequency();
+
+    // Clock sources for Stopwatch. read() returns the counter and, if REPORTS_CPU, sets cpu to the TSC_AUX it was read on.
+    struct RdtscClock {
+        static constexpr const char *NAME = "rdtsc";
+        static constexpr bool COUNTS_TSC = true;
+        static constexpr bool REPORTS_CPU = false;
+
+        static uint64_t read(unsigned int &) {
+            return __rdtsc();
+        }
+    };
+
+    struct RdtscpClock {
+        static constexpr const char *NAME = "rdtscp";
+        static constexpr bool COUNTS_TSC = true;
+        static constexpr bool REPORTS_CPU = true;
+
+        static uint64_t read(unsigned int &cpu) {
+            return __rdtscp(&cpu);
+        }
+    };
+
+    // Counts nanoseconds instead of TSC ticks.
+    struct MonotonicRawClock {
+        static constexpr const char *NAME = "clock_gettime";
+        static constexpr bool COUNTS_TSC = false;
+        static constexpr bool REPORTS_CPU = false;
+
+        static uint64_t read(unsigned int &) {
+            timespec now;
+            clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+            return now.tv_sec * 1000000000ull + now.tv_nsec;
+        }
+    };
+
+    namespace detail {
+        inline void serialize() {
+            uint32_t eax = 0, ebx, ecx, edx;
+            asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : : "memory");
+        }
+    }
+
+    // Fence policies for Stopwatch, which decide what may be reordered across the clock reads.
+    struct NoFence {
+        static constexpr const char *NAME = "none";
+
+        static void beforeStart() {
+        }
+
+        static void afterStart() {
+        }
+
+        static void beforeStop() {
+        }
+
+        static void afterStop() {
+        }
+    };
+
+    // Keeps the timed code from starting before the start read or finishing after the stop read.
+    struct LoadFence {
+        static constexpr const char *NAME = "lfence";
+
+        static void beforeStart() {
+        }
+
+        static void afterStart() {
+            _mm_lfence();
+        }
+
+        static void beforeStop() {
+            _mm_lfence();
+        }
+
+        static void afterStop() {
+        }
+    };
+
+    // Like LoadFence, but also waits for the timed code's stores to become visible before stopping.
+    struct MemoryFence {
+        static constexpr const char *NAME = "mfence";
+
+        static void beforeStart() {
+        }
+
+        static void afterStart() {
+            _mm_lfence();
+        }
+
+        static void beforeStop() {
+            _mm_mfence();
+        }
+
+        static void afterStop() {
+        }
+    };
+
+    // cpuid around both reads, as in Intel's "How to Benchmark Code Execution Times" white paper.
+    struct SerializingFence {
+        static constexpr const char *NAME = "cpuid";
+
+        static void beforeStart() {
+            detail::serialize();
+        }
+
+        static void afterStart() {
+        }
+
+        static void beforeStop() {
+        }
+
+        static void afterStop() {
+            detail::serialize();
+        }
+    };
+
+    template<typename ClockPolicy = RdtscpClock, typename FencePolicy = MemoryFence>
     class Stopwatch;
     class Waiter;
 
+    class Pacer;
+
+    // How a Waiter passes the time.
+    enum class WaitStrategy {
+        Automatic, // Tpause if the CPU supports it, otherwise PauseLoop
+        PauseLoop,
+        UnrolledPauseLoop,
+        Rdtscp,
+        Tpause, // Falls back to PauseLoop if the CPU doesn't support it
+        Nanosleep,
+        SystemClockSpin,
+        ThreadSleep,
+        // Sleeps with clock_nanosleep for all but the last part of the wait, then spins like Automatic.
+        // The spinning part is as long as the worst wakeup latency TimerFactory measured for this host.
+        Hybrid,
+    };
+
+    // What one start/stop pair of a given Stopwatch configuration costs.
+    struct StopwatchOverhead {
+        const char *clock;
+        const char *fence;
+        // Time taken per start/stop pair when called back to back.
+        double costNanoseconds;
+        // Median reading of a stopwatch stopped immediately after it's started.
+        uint64_t emptyReadingNanoseconds;
+    };
+
+    namespace detail {
+        class CalibrationCache;
+
+        // Linux puts the NUMA node above the cpu number in TSC_AUX, which rdtscp returns.
+        constexpr unsigned int TSC_AUX_CPU_MASK = 0xfff;
+    }
+
+    struct TimerFactoryOptions {
+        // File through which processes on this host share calibration results. Empty disables sharing.
+        std::string calibrationCachePath = "/dev/shm/timetools-calibration";
+        // Calibrate every core in parallel on construction instead of each core on first use.
+        bool eagerCalibration = false;
+        // Subtract each Stopwatch configuration's own overhead from its readings, and each spinning Waiter
+        // strategy's measured error from its waits.
+        bool compensateOverhead = true;
+        // Measure every online core's TSC offset on construction, so that rdtscp stopwatches survive migration.
+        bool measureTscOffsets = false;
+    };
+
+    // How far each core's TSC is ahead of a reference core's at the same instant.
+    struct TscOffsetTable {
+        unsigned int referenceCore = 0;
+        // Indexed by core. Zero for the reference core and for cores that weren't measured.
+        std::vector<int64_t> offsetTicks;
+        // The offset is known to within this many ticks either way, or UINT64_MAX if it wasn't measured.
+        std::vector<uint64_t> uncertaintyTicks;
+
+        // What to add to a reading taken on one core to put it in another core's timebase.
+        [[nodiscard]] int64_t getOffsetTicks(const unsigned int fromCore, const unsigned int toCore) const {
+            if (fromCore >= offsetTicks.size() || toCore >= offsetTicks.size())
+                return 0;
+            return offsetTicks[toCore] - offsetTicks[fromCore];
+        }
+    };
+
+    // A spinning wait strategy's median error, by duration, which the Waiter subtracts from each wait.
+    // Bucket i holds the error for waits of 2^(i + MIN_DURATION_LOG2) up to twice that many nanoseconds.
+    struct WaitErrorModel {
+        static constexpr int MIN_DURATION_LOG2 = 3;
+        static constexpr int BUCKET_COUNT = 18;
+        uint64_t correctionTsc[BUCKET_COUNT] = {};
+
+        [[nodiscard]] uint64_t getCorrectionTsc(const uint64_t nanoseconds) const {
+            const auto bucket = std::clamp(static_cast<int>(std::bit_width(nanoseconds)) - 1 - MIN_DURATION_LOG2,
+                                           0, BUCKET_COUNT - 1);
+            return correctionTsc[bucket];
+        }
+    };
+
     class TimerFactory {
-        // core number x tscPerNanosecond_shl25
-        uint64_t *tscPerNanosecond_shl25perCore;
+        // core number x tscPerNanosecond_shl25, or 0 if that core hasn't been calibrated yet.
+        // Written at most once per core, so readers never need to lock.
+        std::unique_ptr<std::atomic<uint64_t>[]> tscPerNanosecond_shl25perCore;
+        unsigned int coreCount;
+        std::unique_ptr<detail::CalibrationCache> calibrationCache;
+        std::atomic<uint64_t> sleepWakeupLatencyNs = 0;
+        bool compensateOverhead;
+        std::mutex waitErrorModelsMutex;
+        std::map<WaitStrategy, WaitErrorModel> waitErrorModels;
+        std::atomic<std::shared_ptr<const TscOffsetTable>> tscOffsets;
+
+        uint64_t calibrateCore(unsigned int coreId);
 
         [[nodiscard]] uint64_t getTscRateForCurrentCore();
 
+        // Median reading of a stopwatch of the given configuration stopped immediately after being started.
+        template<typename ClockPolicy, typename FencePolicy>
+        [[nodiscard]] static uint64_t measureEmptyReadingTicks();
+
+        // Like measureEmptyReadingTicks(), but only measured once per process.
+        template<typename ClockPolicy, typename FencePolicy>
+        [[nodiscard]] static uint64_t getStopwatchOverheadTicks();
+
         [[nodiscard]] uint64_t estimateStartStopOverheadTsc();
 
-        uint64_t estimateLoopSpeed();
+        [[nodiscard]] WaitErrorModel measureWaitErrorModel(Waiter waiter);
 
     public:
-        TimerFactory();
+        explicit TimerFactory(const TimerFactoryOptions &options = {});
+
+        ~TimerFactory();
+
+        // Calibrates every online core that isn't calibrated yet, using one thread pinned to each.
+        void calibrateAllCores();
+
+        // Returns the given core's TSC frequency, or 0 if it hasn't been calibrated.
+        [[nodiscard]] uint64_t getTscFrequencyHz(unsigned int coreId) const;
+
+        // Measures each online core's TSC offset from the first online core's by bouncing a cache line between
+        // threads pinned to the two, in the manner of the kernel's tsc_sync check. Takes a few milliseconds per core.
+        // Stopwatches created afterwards correct for the offset when their thread migrates.
+        void measureTscOffsets();
+
+        // Returns the last table measureTscOffsets() made, or null if it hasn't been called.
+        [[nodiscard]] std::shared_ptr<const TscOffsetTable> getTscOffsets() const {
+            return tscOffsets.load(std::memory_order_acquire);
+        }
+
+        // Returns one more than the highest core number this factory can hold a calibration for.
+        [[nodiscard]] unsigned int getCoreCount() const {
+            return coreCount;
+        }
+
+        template<typename ClockPolicy = RdtscpClock, typename FencePolicy = MemoryFence>
+        [[nodiscard]] Stopwatch<ClockPolicy, FencePolicy> createStopwatch();
+
+        template<typename ClockPolicy, typename FencePolicy>
+        [[nodiscard]] StopwatchOverhead measureStopwatchOverhead();
+
+        // Measures every supported clock and fence combination on the current core.
+        [[nodiscard]] std::vector<StopwatchOverhead> measureStopwatchOverheads();
+
+        [[nodiscard]] Waiter createWaiter(WaitStrategy strategy = WaitStrategy::Automatic);
+
+        // Converts at the current core's rate, calibrating it on first use, like the stopwatches and waiters.
+        [[nodiscard]] TscConversion createTscConversion();
 
-        [[nodiscard]] Stopwatch createStopwatch();
+        // Converts at the given core's rate, or at the current core's if the given one hasn't been calibrated.
+        [[nodiscard]] TscConversion createTscConversion(unsigned int coreId);
 
-        [[nodiscard]] Waiter createWaiter();
+        // Creates a pacer that lets eventsPerDeadline events through at each deadline, with deadlines spaced so that
+        // the average rate is eventsPerSecond. Throws std::invalid_argument if either is not positive.
+        [[nodiscard]] Pacer createPacer(double eventsPerSecond, uint64_t eventsPerDeadline = 1,
+                                        WaitStrategy strategy = WaitStrategy::Automatic);
+
+        // Returns how late clock_nanosleep wakes up on this host in the worst case, measured on first use.
+        [[nodiscard]] uint64_t getSleepWakeupLatencyNs();
+
+        // Returns the error model for a spinning strategy, measuring it on the current core on first use.
+        // Strategies that sleep, and Automatic, have an empty model.
+        [[nodiscard]] WaitErrorModel getWaitErrorModel(WaitStrategy strategy);
     };
 
+    template<typename ClockPolicy, typename FencePolicy>
     class Stopwatch {
         friend class TimerFactory;
-        uint64_t nanosecondPerTsc_shr16;
+        TscConversion conversion;
         uint64_t startTsc = 0;
         uint64_t elapsedTsc = 0;
+        uint64_t overheadTicks = 0;
         unsigned int startCpu;
+        std::shared_ptr<const TscOffsetTable> tscOffsets;
 
-        explicit Stopwatch(uint64_t tscPerNanosecond_shl25) {
-            //std::cout << "Stopwatch's TSCs per nanosecond: " << (tscPerNanosecond_shl25 >> 25) << "\n";
-            const auto asDouble = static_cast<double>(tscPerNanosecond_shl25);
-            const auto unshifted = asDouble / (1 << 25);
-            const auto nanosPerTsc = 1 / unshifted;
-            const auto shiftedLeft = nanosPerTsc * (1 << 16);
-            nanosecondPerTsc_shr16 = static_cast<uint64_t>(shiftedLeft);
+        explicit Stopwatch(uint64_t tscPerNanosecond_shl25)
+            : conversion(ClockPolicy::COUNTS_TSC ? tscPerNanosecond_shl25 : 1 << 25) {
+        }
+
+        uint64_t stopInterval() {
+            unsigned int stopCpu;
+            FencePolicy::beforeStop();
+            auto stopTsc = ClockPolicy::read(stopCpu);
+            FencePolicy::afterStop();
+            if constexpr (ClockPolicy::REPORTS_CPU) {
+                if (startCpu != stopCpu) [[unlikely]] {
+                    // The thread migrated, so put the stop reading in the start core's timebase.
+                    assert(tscOffsets); // Without offsets, this stopwatch is unreliable if the CPU changes.
+                    if (tscOffsets)
+                        stopTsc += tscOffsets->getOffsetTicks(stopCpu & detail::TSC_AUX_CPU_MASK,
+                                                              startCpu & detail::TSC_AUX_CPU_MASK);
+                }
+            }
+            const auto intervalTsc = stopTsc > startTsc ? stopTsc - startTsc : 0;
+            return intervalTsc > overheadTicks ? intervalTsc - overheadTicks : 0;
         }
 
     public:
-        void start();
+        void start() {
+            FencePolicy::beforeStart();
+            startTsc = ClockPolicy::read(startCpu);
+            FencePolicy::afterStart();
+        }
+
+        void stop() {
+            elapsedTsc += stopInterval();
+        }
+
+        // Stops the stopwatch and also records this interval alone, in clock ticks, to the given histogram.
+        template<typename Histogram>
+        void stopAndRecord(Histogram &histogram) {
+            const auto intervalTsc = stopInterval();
+            elapsedTsc += intervalTsc;
+            histogram.record(intervalTsc);
+        }
 
-        void stop();
+        void reset() {
+            elapsedTsc = 0;
+        }
 
-        void reset();
+        [[nodiscard]] uint64_t getElapsedNanoseconds() const {
+            return toNanoseconds(elapsedTsc);
+        }
+
+        // Elapsed clock ticks, which are TSC ticks unless the clock is MonotonicRawClock.
+        [[nodiscard]] uint64_t getElapsedTicks() const {
+            return elapsedTsc;
+        }
 
-        [[nodiscard]] uint64_t getElapsedNanoseconds() const;
+        // Converts this stopwatch's clock ticks, such as those recorded by stopAndRecord(), to nanoseconds.
+        [[nodiscard]] uint64_t toNanoseconds(const uint64_t ticks) const {
+            return conversion.toNanoseconds(ticks);
+        }
+
+        // For converting many recorded intervals at once.
+        [[nodiscard]] const TscConversion &getConversion() const {
+            return conversion;
+        }
     };
 
+    template<typename ClockPolicy, typename FencePolicy>
+    Stopwatch<ClockPolicy, FencePolicy> TimerFactory::createStopwatch() {
+        // Assume the stopwatch will be used on the current core.
+        Stopwatch<ClockPolicy, FencePolicy> stopwatch(getTscRateForCurrentCore());
+        if (compensateOverhead)
+            stopwatch.overheadTicks = getStopwatchOverheadTicks<ClockPolicy, FencePolicy>();
+        if constexpr (ClockPolicy::REPORTS_CPU)
+            stopwatch.tscOffsets = getTscOffsets();
+        return stopwatch;
+    }
+
+    template<typename ClockPolicy, typename FencePolicy>
+    uint64_t TimerFactory::measureEmptyReadingTicks() {
+        constexpr int TRIALS = 1001;
+        // Raw ticks don't depend on the rate.
+        Stopwatch<ClockPolicy, FencePolicy> stopwatch(1 << 25);
+        std::vector<uint64_t> readings;
+        readings.reserve(TRIALS);
+        for (int trial = 0; trial < TRIALS; ++trial) {
+            stopwatch.reset();
+            stopwatch.start();
+            stopwatch.stop();
+            readings.push_back(stopwatch.elapsedTsc);
+        }
+        std::nth_element(readings.begin(), readings.begin() + TRIALS / 2, readings.end());
+        return readings[TRIALS / 2];
+    }
+
+    template<typename ClockPolicy, typename FencePolicy>
+    uint64_t TimerFactory::getStopwatchOverheadTicks() {
+        // The overhead belongs to the machine rather than the factory.
+        static const uint64_t overheadTicks = measureEmptyReadingTicks<ClockPolicy, FencePolicy>();
+        return overheadTicks;
+    }
+
+    template<typename ClockPolicy, typename FencePolicy>
+    StopwatchOverhead TimerFactory::measureStopwatchOverhead() {
+        constexpr int TRIALS = 1001;
+        // Without overhead compensation, so that the empty reading is the raw overhead.
+        Stopwatch<ClockPolicy, FencePolicy> stopwatch(getTscRateForCurrentCore());
+
+        const auto before = __rdtsc();
+        for (int trial = 0; trial < TRIALS; ++trial) {
+            stopwatch.start();
+            stopwatch.stop();
+        }
+        const auto after = __rdtsc();
+
+        StopwatchOverhead overhead;
+        overhead.clock = ClockPolicy::NAME;
+        overhead.fence = FencePolicy::NAME;
+        const auto tscPerNanosecond = static_cast<double>(getTscRateForCurrentCore()) / (1 << 25);
+        overhead.costNanoseconds = static_cast<double>(after - before) / tscPerNanosecond / TRIALS;
+        overhead.emptyReadingNanoseconds = stopwatch.toNanoseconds(measureEmptyReadingTicks<ClockPolicy, FencePolicy>());
+        return overhead;
+    }
+
     class Waiter {
         friend class TimerFactory;
+        using WaitFunction = void (Waiter::*)(uint64_t nanosecondsToWait) const;
+
         uint64_t tscPerNanosecond_shl25; // TSC per nanosecond * 2^25
-        uint64_t overheadTsc;
+        TscConversion conversion;
+        WaitErrorModel errorModel;
+        WaitStrategy strategy;
+        WaitFunction waitFunction;
+        bool useTpause;
+        uint64_t hybridSpinNs = 0;
 
         void rdtscPauseLoopWait(uint64_t nanosecondsToWait) const;
 
@@ -65,20 +470,118 @@ namespace timetools {
 
         void rdtscpWait(uint64_t nanosecondsToWait) const;
 
-        void tpauseLoopWait(uint64_t nanosecondsToWait);
+        void tpauseLoopWait(uint64_t nanosecondsToWait) const;
+
+        void systemClockBusyWait(uint64_t nanosecondsToWait) const;
+
+        void nanosleepWait(uint64_t nanosecondsToWait) const;
 
-        void systemClockBusyWait(uint64_t nanosecondsToWait);
+        void threadSleep(uint64_t nanosecondsToWait) const;
 
-        void nanosleepWait(uint64_t nanosecondsToWait);
+        void hybridWait(uint64_t nanosecondsToWait) const;
 
-        void threadSleep(uint64_t nanosecondsToWait);
+        void spinUntilTsc(uint64_t deadlineTsc) const;
 
-        explicit Waiter(uint64_t tscPerNanosecond_shl25)
-            : tscPerNanosecond_shl25(tscPerNanosecond_shl25) {
-            //std::cout << "Waiter's TSCs per nanosecond: " << (tscPerNanosecond_shl25 >> 25) << "\n";
+        // Converts the wait to TSC ticks and subtracts the expected error, without going below zero.
+        [[nodiscard]] uint64_t getCorrectedWaitTsc(const uint64_t nanosecondsToWait) const {
+            const auto waitTsc = conversion.toTicks(nanosecondsToWait);
+            const auto correctionTsc = errorModel.getCorrectionTsc(nanosecondsToWait);
+            return waitTsc > correctionTsc ? waitTsc - correctionTsc : 0;
         }
 
+        Waiter(uint64_t tscPerNanosecond_shl25, WaitStrategy strategy, uint64_t hybridSpinNs);
+
     public:
-        void busyWait(uint64_t nanosecondsToWait);
+        void busyWait(const uint64_t nanosecondsToWait) {
+            (this->*waitFunction)(nanosecondsToWait);
+        }
+
+        // Waits until the TSC reaches the given value, returning immediately if it already has.
+        // Unlike busyWait(), errors don't accumulate when called with evenly spaced deadlines.
+        void waitUntilTsc(uint64_t deadlineTsc) const;
+
+        // Waits until the value at the address differs from expected or the timeout passes, and returns whether it
+        // changed. Whatever the strategy, on CPUs with WAITPKG this arms umonitor on the value's cache line and sleeps
+        // in umwait until a store to it or the deadline, waking within tens of nanoseconds without keeping the core's
+        // pipeline busy. Elsewhere it polls in a pause loop.
+        bool waitForChange(const volatile uint32_t *address, uint32_t expected, uint64_t timeoutNanoseconds) const;
+
+        bool waitForChange(const volatile uint64_t *address, uint64_t expected, uint64_t timeoutNanoseconds) const;
+
+        // The strategy actually in use; never Automatic.
+        [[nodiscard]] WaitStrategy getStrategy() const {
+            return strategy;
+        }
+
+        // Whether the CPU supports the WAITPKG instructions (tpause, umonitor and umwait).
+        [[nodiscard]] static bool hasTpause();
+    };
+
+    // Paces a loop against absolute TSC deadlines that advance by a fixed period, so that lateness in one iteration
+    // doesn't push back every iteration after it. The period is kept to 1/2^32 of a tick.
+    // Create with TimerFactory::createPacer().
+    class Pacer {
+        friend class TimerFactory;
+        Waiter waiter;
+        TscConversion conversion;
+        uint64_t periodTsc;
+        uint32_t periodFraction_shl32;
+        uint64_t eventsPerDeadline;
+        uint64_t deadlineTsc = 0;
+        uint32_t deadlineFraction_shl32 = 0;
+        uint64_t eventsLeft = 0;
+        uint64_t deadlineCount = 0;
+        uint64_t overrunCount = 0;
+        uint64_t maximumLatenessTsc = 0;
+
+        Pacer(const Waiter &waiter, uint64_t tscPerNanosecond_shl25, double periodTsc, uint64_t eventsPerDeadline);
+
+        void advanceDeadline() {
+            const uint64_t fraction = static_cast<uint64_t>(deadlineFraction_shl32) + periodFraction_shl32;
+            deadlineTsc += periodTsc + (fraction >> 32);
+            deadlineFraction_shl32 = static_cast<uint32_t>(fraction);
+        }
+
+    public:
+        // Makes the first deadline now. A new pacer starts when it's created; call this again to restart the
+        // schedule, for example after a long overrun that shouldn't be caught up on.
+        void start();
+
+        // Call before each event. Waits for the deadline at the start of each batch, and returns false
+        // if that deadline had already passed, in which case the batch goes out immediately to catch up.
+        bool pace() {
+            if (eventsLeft != 0) [[likely]] {
+                --eventsLeft;
+                return true;
+            }
+            advanceDeadline();
+            ++deadlineCount;
+            eventsLeft = eventsPerDeadline - 1;
+            if (const auto now = __rdtsc(); now > deadlineTsc) {
+                ++overrunCount;
+                maximumLatenessTsc = std::max<uint64_t>(maximumLatenessTsc, now - deadlineTsc);
+                return false;
+            }
+            waiter.waitUntilTsc(deadlineTsc);
+            return true;
+        }
+
+        [[nodiscard]] uint64_t getNextDeadlineTsc() const {
+            return eventsLeft != 0 ? deadlineTsc : deadlineTsc + periodTsc;
+        }
+
+        // Deadlines reached since start(), including the first.
+        [[nodiscard]] uint64_t getDeadlineCount() const {
+            return deadlineCount;
+        }
+
+        // Deadlines that had already passed by the time pace() was called for them.
+        [[nodiscard]] uint64_t getOverrunCount() const {
+            return overrunCount;
+        }
+
+        [[nodiscard]] uint64_t getMaximumLatenessNanoseconds() const {
+            return conversion.toNanoseconds(maximumLatenessTsc);
+        }
     };
 }
@@ -0,0 +1,159 @@
+#include "Utility.h"
+#include <atomic>
+#include <cpuid.h>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace timetools::detail {
+    // The cache file is a header followed by one frequency (in Hz) per cpu; zero means not yet calibrated.
+    struct CalibrationCache::Key {
+        uint32_t signature; // CPUID leaf 1 EAX: family, model and stepping
+        uint32_t reserved;
+        uint64_t microcode;
+        char brand[48];
+        char bootId[40];
+
+        bool operator==(const Key &) const = default;
+    };
+
+    struct CalibrationCache::Header {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t cpuCapacity;
+        Key key;
+    };
+
+    static constexpr uint64_t CACHE_MAGIC = 0x6c61437374746d74; // "tmttsCal"
+    static constexpr uint32_t CACHE_VERSION = 1;
+
+    CalibrationCache::Key CalibrationCache::currentKey() {
+        Key key;
+        std::memset(&key, 0, sizeof(key));
+        uint32_t eax, ebx, ecx, edx;
+        __cpuid(1, eax, ebx, ecx, edx);
+        key.signature = eax;
+        if (__get_cpuid(0x80000004, &eax, &ebx, &ecx, &edx)) {
+            auto *brand = reinterpret_cast<uint32_t *>(key.brand);
+            for (uint32_t leaf = 0x80000002; leaf <= 0x80000004; ++leaf) {
+                __cpuid(leaf, brand[0], brand[1], brand[2], brand[3]);
+                brand += 4;
+            }
+        }
+        std::ifstream cpuinfo("/proc/cpuinfo");
+        std::string line;
+        while (std::getline(cpuinfo, line)) {
+            if (line.starts_with("microcode")) {
+                const auto colon = line.find(':');
+                if (colon != std::string::npos)
+                    key.microcode = std::stoull(line.substr(colon + 1), nullptr, 0);
+                break;
+            }
+        }
+        std::ifstream bootId("/proc/sys/kernel/random/boot_id");
+        bootId.read(key.bootId, sizeof(key.bootId) - 1);
+        return key;
+    }
+
+    CalibrationCache::CalibrationCache(std::string path)
+        : path(std::move(path)), key(std::make_unique<Key>(currentKey())) {
+        mapReadOnly();
+    }
+
+    CalibrationCache::~CalibrationCache() {
+        if (const auto *header = mapping.load(); header != nullptr)
+            munmap(const_cast<Header *>(header), mappingSize);
+    }
+
+    // Anyone can create files in /dev/shm, so only believe one that nobody but its owner, and only this user or root,
+    // could have written.
+    static bool isTrusted(const struct stat &status) {
+        return S_ISREG(status.st_mode) && (status.st_uid == geteuid() || status.st_uid == 0)
+               && (status.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+    }
+
+    void CalibrationCache::mapReadOnly() {
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+        if (fd < 0)
+            return;
+        // The file only ever grows, but hold off a writer while the header is checked anyway.
+        if (flock(fd, LOCK_SH) != 0) {
+            close(fd);
+            return;
+        }
+        struct stat status;
+        if (fstat(fd, &status) == 0 && isTrusted(status) && static_cast<size_t>(status.st_size) >= sizeof(Header)) {
+            const auto size = static_cast<size_t>(status.st_size);
+            void *address = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (address != MAP_FAILED) {
+                const auto *header = static_cast<const Header *>(address);
+                const auto expectedSize = sizeof(Header) + header->cpuCapacity * sizeof(uint64_t);
+                if (header->magic == CACHE_MAGIC && header->version == CACHE_VERSION
+                    && header->key == *key && size >= expectedSize) {
+                    mappingSize = size;
+                    mapping.store(header, std::memory_order_release);
+                } else {
+                    munmap(address, size);
+                }
+            }
+        }
+        flock(fd, LOCK_UN);
+        close(fd);
+    }
+
+    uint64_t CalibrationCache::lookup(const unsigned int cpu) const {
+        const auto *header = mapping.load(std::memory_order_acquire);
+        // The header is rewritten in place if another process finds it stale, so check it's still ours, and never
+        // read past what was mapped.
+        if (header == nullptr || cpu >= header->cpuCapacity || header->key != *key
+            || sizeof(Header) + (cpu + 1) * sizeof(uint64_t) > mappingSize)
+            return 0;
+        auto *entries = reinterpret_cast<uint64_t *>(const_cast<Header *>(header) + 1);
+        return std::atomic_ref(entries[cpu]).load(std::memory_order_acquire);
+    }
+
+    void CalibrationCache::store(const unsigned int cpu, const uint64_t frequencyHz) {
+        std::lock_guard lock(storeMutex);
+        const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0644);
+        if (fd < 0)
+            return;
+        struct stat status;
+        if (fstat(fd, &status) == 0 && isTrusted(status) && flock(fd, LOCK_EX) == 0) {
+            Header header;
+            const bool valid = pread(fd, &header, sizeof(header), 0) == sizeof(header)
+                               && header.magic == CACHE_MAGIC && header.version == CACHE_VERSION
+                               && header.key == *key;
+            if (!valid) {
+                // Created by someone else under a different boot, CPU or microcode (or not at all); start over.
+                // Rewrite it in place rather than truncating it, since other processes may have it mapped, and
+                // reading a mapping past the end of a shrunk file raises SIGBUS.
+                std::memset(&header, 0, sizeof(header));
+                header.magic = CACHE_MAGIC;
+                header.version = CACHE_VERSION;
+                header.cpuCapacity = getPossibleCpuCount();
+                header.key = *key;
+                const auto size = static_cast<off_t>(sizeof(Header) + header.cpuCapacity * sizeof(uint64_t));
+                const std::vector<uint64_t> zeroes(header.cpuCapacity, 0);
+                const auto entriesSize = static_cast<ssize_t>(zeroes.size() * sizeof(uint64_t));
+                if ((status.st_size < size && ftruncate(fd, size) != 0)
+                    || pwrite(fd, zeroes.data(), entriesSize, sizeof(Header)) != entriesSize
+                    || pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+                    header.cpuCapacity = 0;
+                }
+            }
+            if (cpu < header.cpuCapacity) {
+                const auto offset = static_cast<off_t>(sizeof(Header) + cpu * sizeof(uint64_t));
+                (void) pwrite(fd, &frequencyHz, sizeof(frequencyHz), offset);
+            }
+            flock(fd, LOCK_UN);
+        }
+        close(fd);
+        if (mapping == nullptr)
+            mapReadOnly();
+    }
+}
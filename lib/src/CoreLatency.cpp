@@ -0,0 +1,156 @@
+#include "CoreLatency.h"
+#include "Utility.h"
+#include <atomic>
+#include <iomanip>
+#include <thread>
+
+namespace timetools {
+    // About a millisecond of pauses.
+    static constexpr int SPINS_BEFORE_YIELD = 1 << 15;
+
+    struct alignas(64) Line {
+        std::atomic<uint64_t> value = 0;
+    };
+
+    static void waitForValue(const Line &line, const uint64_t value) {
+        for (int spins = 0; line.value.load(std::memory_order_acquire) != value;) {
+            if (++spins < SPINS_BEFORE_YIELD) {
+                _mm_pause();
+            } else {
+                std::this_thread::yield();
+                spins = 0;
+            }
+        }
+    }
+
+    static void measurePair(CorePairLatency &result, const int initiatorCpu, const int responderCpu,
+                            const TscConversion &conversion, const CoreLatencyOptions &options) {
+        Line line;
+        std::atomic<int> responderError = -1;
+        const auto rounds = options.warmupRoundTrips + options.roundTrips;
+        // The initiator writes odd values and the responder answers with the next even one.
+        std::thread responder([&]() {
+            const auto error = setThisThreadAffinity(responderCpu);
+            responderError = error;
+            if (error != 0)
+                return;
+            for (uint64_t round = 0; round < rounds; ++round) {
+                waitForValue(line, 2 * round + 1);
+                line.value.store(2 * round + 2, std::memory_order_release);
+            }
+        });
+        result.error = setThisThreadAffinity(initiatorCpu);
+        while (responderError.load() < 0)
+            std::this_thread::yield();
+        if (result.error == 0)
+            result.error = responderError;
+        if (result.error != 0) {
+            // Let the responder run out, if it's waiting.
+            for (uint64_t round = 0; responderError == 0 && round < rounds; ++round) {
+                line.value.store(2 * round + 1, std::memory_order_release);
+                waitForValue(line, 2 * round + 2);
+            }
+            responder.join();
+            return;
+        }
+        for (uint64_t round = 0; round < rounds; ++round) {
+            const auto before = __rdtsc();
+            line.value.store(2 * round + 1, std::memory_order_release);
+            waitForValue(line, 2 * round + 2);
+            const auto after = __rdtsc();
+            if (round >= options.warmupRoundTrips)
+                result.roundTripNanoseconds.record(conversion.toNanoseconds(after - before));
+        }
+        responder.join();
+    }
+
+    CoreLatencyMatrix measureCoreLatency(TimerFactory &factory, const CoreLatencyOptions &options) {
+        CoreLatencyMatrix matrix;
+        matrix.cpus = options.cpus.empty() ? detail::getOnlineCpus() : options.cpus;
+        const auto &cpus = matrix.cpus;
+        factory.calibrateAllCores();
+        matrix.pairs.resize(cpus.size() * cpus.size());
+        for (auto &pair: matrix.pairs)
+            pair.error = 0;
+
+        // Measured one pair at a time from a thread of its own, so that pinning doesn't move the caller.
+        std::thread([&]() {
+            for (size_t row = 0; row < cpus.size(); ++row) {
+                const auto conversion = factory.createTscConversion(static_cast<unsigned int>(cpus[row]));
+                for (size_t column = row + 1; column < cpus.size(); ++column) {
+                    auto &pair = matrix.pairs[row * cpus.size() + column];
+                    measurePair(pair, cpus[row], cpus[column], conversion, options);
+                    matrix.pairs[column * cpus.size() + row].error = pair.error;
+                    matrix.pairs[column * cpus.size() + row].roundTripNanoseconds.merge(pair.roundTripNanoseconds);
+                }
+            }
+        }).join();
+        return matrix;
+    }
+
+    void CoreLatencyMatrix::print(std::ostream &out, const double percentile) const {
+        out << "p" << percentile << " round trip ns\n   ";
+        for (const auto cpu: cpus)
+            out << std::setw(7) << cpu;
+        out << "\n";
+        for (size_t row = 0; row < cpus.size(); ++row) {
+            out << std::setw(3) << cpus[row];
+            for (size_t column = 0; column < cpus.size(); ++column) {
+                const auto &pair = at(row, column);
+                if (pair.error != 0)
+                    out << std::setw(7) << "error";
+                else if (pair.roundTripNanoseconds.getCount() == 0)
+                    out << std::setw(7) << "-";
+                else
+                    out << std::setw(7) << pair.roundTripNanoseconds.getValueAtPercentile(percentile);
+            }
+            out << "\n";
+        }
+    }
+
+    void CoreLatencyMatrix::writeCsv(std::ostream &out, const double percentile) const {
+        out << "cpu";
+        for (const auto cpu: cpus)
+            out << "," << cpu;
+        out << "\n";
+        for (size_t row = 0; row < cpus.size(); ++row) {
+            out << cpus[row];
+            for (size_t column = 0; column < cpus.size(); ++column) {
+                out << ",";
+                const auto &pair = at(row, column);
+                if (pair.error == 0 && pair.roundTripNanoseconds.getCount() != 0)
+                    out << pair.roundTripNanoseconds.getValueAtPercentile(percentile);
+            }
+            out << "\n";
+        }
+    }
+
+    void CoreLatencyMatrix::writeJson(std::ostream &out) const {
+        const auto writeMatrix = [&](const char *name, const auto &getValue) {
+            out << ",\n  \"" << name << "\": [";
+            for (size_t row = 0; row < cpus.size(); ++row) {
+                out << (row == 0 ? "\n    [" : ",\n    [");
+                for (size_t column = 0; column < cpus.size(); ++column) {
+                    if (column != 0)
+                        out << ", ";
+                    const auto &pair = at(row, column);
+                    if (pair.error == 0 && pair.roundTripNanoseconds.getCount() != 0)
+                        out << getValue(pair.roundTripNanoseconds);
+                    else
+                        out << "null";
+                }
+                out << "]";
+            }
+            out << "\n  ]";
+        };
+        out << "{\n  \"cpus\": [";
+        for (size_t i = 0; i < cpus.size(); ++i)
+            out << (i == 0 ? "" : ", ") << cpus[i];
+        out << "]";
+        writeMatrix("p50", [](const LatencyHistogram &histogram) { return histogram.getValueAtPercentile(50); });
+        writeMatrix("p99", [](const LatencyHistogram &histogram) { return histogram.getValueAtPercentile(99); });
+        writeMatrix("p99.9", [](const LatencyHistogram &histogram) { return histogram.getValueAtPercentile(99.9); });
+        writeMatrix("max", [](const LatencyHistogram &histogram) { return histogram.getMaximum(); });
+        out << "\n}\n";
+    }
+}
@@ -0,0 +1,26 @@
+#include "Deadline.h"
+
+namespace timetools {
+    Deadline::Deadline(const TscConversion &conversion, const uint64_t deadlineTsc, const uint32_t pollInterval,
+                       ShardedLatencyHistogram *overshoots)
+        : conversion(conversion), deadlineTsc(deadlineTsc), pollInterval(std::max<uint32_t>(pollInterval, 1)),
+          pollsLeft(this->pollInterval), overshoots(overshoots) {
+    }
+
+    Deadline::Deadline(TimerFactory &factory, const uint64_t budgetNanoseconds, const uint32_t pollInterval,
+                       ShardedLatencyHistogram *overshoots)
+        : Deadline(factory.createTscConversion(), 0, pollInterval, overshoots) {
+        const auto budgetTsc = conversion.toTicks(budgetNanoseconds);
+        const auto now = __rdtsc();
+        // Saturate, so that an unlimited budget never expires.
+        deadlineTsc = budgetTsc > UINT64_MAX - now ? UINT64_MAX : now + budgetTsc;
+    }
+
+    Deadline Deadline::createChild(const uint64_t budgetNanoseconds, const uint32_t childPollInterval,
+                                   ShardedLatencyHistogram *childOvershoots) const {
+        const auto budgetTsc = conversion.toTicks(budgetNanoseconds);
+        const auto now = __rdtsc();
+        const auto childDeadlineTsc = budgetTsc > UINT64_MAX - now ? UINT64_MAX : now + budgetTsc;
+        return {conversion, std::min<uint64_t>(deadlineTsc, childDeadlineTsc), childPollInterval, childOvershoots};
+    }
+}
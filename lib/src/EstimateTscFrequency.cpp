@@ -1,33 +1,152 @@
+#include "timetools.h"
 #include "Utility.h"
+#include <cpuid.h>
 #include <immintrin.h>
-#include <thread>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <vector>
 
 namespace timetools::detail {
-    void __attribute__ ((noinline)) doNothing() {
+    bool hasGoodCpuTimer() {
+        uint32_t eax, ebx, ecx, edx;
+        if (!__get_cpuid(0x15, &eax, &ebx, &ecx, &edx)) {
+            return false;
+        }
+        return eax != 0 && ebx != 0 && ecx != 0;
+    }
+
+    // Returns the TSC frequency from the architectural crystal ratio, or 0 if the CPU doesn't enumerate it.
+    // See the Intel SDM's description of CPUID leaf 15H, and native_calibrate_tsc() in Linux.
+    static uint64_t tscFrequencyFromCpuid() {
+        uint32_t denominator, numerator, crystalHz, edx;
+        if (!__get_cpuid(0x15, &denominator, &numerator, &crystalHz, &edx))
+            return 0;
+        if (denominator == 0 || numerator == 0)
+            return 0;
+        if (crystalHz == 0) {
+            // The crystal frequency isn't enumerated, but it can be derived from the base frequency in leaf 16H.
+            uint32_t baseMhz, ebx, ecx;
+            if (!__get_cpuid(0x16, &baseMhz, &ebx, &ecx, &edx) || baseMhz == 0)
+                return 0;
+            crystalHz = static_cast<uint32_t>(baseMhz * 1000000ull * denominator / numerator);
+        }
+        return static_cast<uint64_t>(crystalHz) * numerator / denominator;
+    }
+
+    // Returns the kernel's tsc_khz in Hz, or 0 if it isn't exposed.
+    static uint64_t tscFrequencyFromKernel() {
+        // Exposed by some kernels (and by the tsc_freq_khz module) alongside cpufreq.
+        std::ifstream sysfs("/sys/devices/system/cpu/cpu0/tsc_freq_khz");
+        uint64_t khz = 0;
+        if (sysfs >> khz && khz != 0)
+            return khz * 1000;
+
+        // Under a hypervisor, the kernel's tsc_khz comes from the timing leaf (KVM and VMware both provide it).
+        uint32_t eax, ebx, ecx, edx;
+        __cpuid(1, eax, ebx, ecx, edx);
+        constexpr uint32_t HYPERVISOR_PRESENT = 1u << 31;
+        if (!(ecx & HYPERVISOR_PRESENT))
+            return 0;
+        __cpuid(0x40000000, eax, ebx, ecx, edx);
+        if (eax < 0x40000010)
+            return 0;
+        __cpuid(0x40000010, eax, ebx, ecx, edx);
+        return static_cast<uint64_t>(eax) * 1000;
     }
 
-    uint64_t timeFunctionCallTsc() {
-        uint64_t totalTsc = 0;
-        constexpr int TRIALS_LOG2 = 10;
-        int trial = 1;
-        for (; trial <= 1 << TRIALS_LOG2; ++trial) {
+    // Reads CLOCK_MONOTONIC_RAW bracketed by two TSC reads, retrying to find a tight bracket.
+    // Returns the clock reading and sets tscMidpoint to the TSC at the moment it was taken.
+    static int64_t sampleMonotonicRaw(double &tscMidpoint) {
+        constexpr int TRIES = 8;
+        uint64_t bestWidth = UINT64_MAX;
+        int64_t bestNs = 0;
+        for (int i = 0; i < TRIES; ++i) {
+            timespec now;
             const auto before = __rdtsc();
-            doNothing();
+            clock_gettime(CLOCK_MONOTONIC_RAW, &now);
             const auto after = __rdtsc();
-            totalTsc += after - before;
+            if (after - before < bestWidth) {
+                bestWidth = after - before;
+                bestNs = now.tv_sec * 1000000000ll + now.tv_nsec;
+                tscMidpoint = static_cast<double>(before) + static_cast<double>(after - before) / 2;
+            }
         }
-        const auto average = totalTsc >> TRIALS_LOG2;
-        return average;
+        return bestNs;
     }
 
-    uint64_t estimateTscFrequencyHz() {
-        const auto overhead = timeFunctionCallTsc();
-        constexpr int DURATION_SECONDS = 5;
-        const auto duration = std::chrono::seconds(DURATION_SECONDS);
-        const auto before = __rdtsc();
-        std::this_thread::sleep_for(duration);
-        const auto after = __rdtsc();
-        const auto tscPerSecond = (after - before - overhead) / DURATION_SECONDS;
-        return tscPerSecond;
+    // Fits the TSC against CLOCK_MONOTONIC_RAW with ordinary least squares over a short window.
+    static TscFrequencyEstimate tscFrequencyFromRegression() {
+        constexpr int64_t DURATION_NS = 20000000;
+        constexpr int64_t SAMPLE_SPACING_NS = 50000;
+        std::vector<double> clockNs;
+        std::vector<double> tsc;
+        clockNs.reserve(DURATION_NS / SAMPLE_SPACING_NS + 1);
+        tsc.reserve(DURATION_NS / SAMPLE_SPACING_NS + 1);
+
+        double firstTsc = 0;
+        const auto firstNs = sampleMonotonicRaw(firstTsc);
+        int64_t nextSampleNs = firstNs;
+        while (true) {
+            double sampleTsc = 0;
+            const auto sampleNs = sampleMonotonicRaw(sampleTsc);
+            if (sampleNs < nextSampleNs)
+                continue;
+            // Work relative to the first sample so the doubles keep their precision.
+            clockNs.push_back(static_cast<double>(sampleNs - firstNs));
+            tsc.push_back(sampleTsc - firstTsc);
+            if (sampleNs - firstNs >= DURATION_NS)
+                break;
+            nextSampleNs = sampleNs + SAMPLE_SPACING_NS;
+        }
+
+        const auto n = static_cast<double>(clockNs.size());
+        double meanNs = 0, meanTsc = 0;
+        for (size_t i = 0; i < clockNs.size(); ++i) {
+            meanNs += clockNs[i];
+            meanTsc += tsc[i];
+        }
+        meanNs /= n;
+        meanTsc /= n;
+        double sxx = 0, sxy = 0;
+        for (size_t i = 0; i < clockNs.size(); ++i) {
+            sxx += (clockNs[i] - meanNs) * (clockNs[i] - meanNs);
+            sxy += (clockNs[i] - meanNs) * (tsc[i] - meanTsc);
+        }
+        const auto tscPerNanosecond = sxy / sxx;
+        double residualSquares = 0;
+        for (size_t i = 0; i < clockNs.size(); ++i) {
+            const auto residual = tsc[i] - meanTsc - tscPerNanosecond * (clockNs[i] - meanNs);
+            residualSquares += residual * residual;
+        }
+        const auto slopeStandardError = std::sqrt(residualSquares / (n - 2) / sxx);
+
+        TscFrequencyEstimate estimate;
+        estimate.frequencyHz = static_cast<uint64_t>(std::llround(tscPerNanosecond * 1e9));
+        estimate.source = TscFrequencySource::Regression;
+        // 1.96 standard errors is a 95% confidence interval.
+        estimate.uncertaintyPpm = 1.96 * slopeStandardError / tscPerNanosecond * 1e6;
+        return estimate;
+    }
+}
+
+namespace timetools {
+    TscFrequencyEstimate estimateTscFrequency() {
+        TscFrequencyEstimate estimate;
+        if (const auto hz = detail::tscFrequencyFromCpuid(); hz != 0) {
+            estimate.frequencyHz = hz;
+            estimate.source = TscFrequencySource::CpuidCrystalRatio;
+            // Exact by definition, up to the tolerance of the crystal itself.
+            estimate.uncertaintyPpm = 0;
+            return estimate;
+        }
+        if (const auto hz = detail::tscFrequencyFromKernel(); hz != 0) {
+            estimate.frequencyHz = hz;
+            estimate.source = TscFrequencySource::Kernel;
+            // The kernel reports whole kHz.
+            estimate.uncertaintyPpm = 500.0 * 1e6 / static_cast<double>(hz);
+            return estimate;
+        }
+        return detail::tscFrequencyFromRegression();
     }
 }
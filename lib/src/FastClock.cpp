@@ -0,0 +1,124 @@
+#include "FastClock.h"
+#include "timetools.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <vector>
+
+namespace timetools::detail {
+    struct ClockSample {
+        uint64_t tsc;
+        uint64_t monotonicNs;
+        int64_t realtimeOffsetNs;
+    };
+
+    static uint64_t toNanoseconds(const timespec &time) {
+        return time.tv_sec * 1000000000ull + time.tv_nsec;
+    }
+
+    // Reads the TSC around clock_gettime a few times and keeps the tightest pair, so that preemption
+    // in the middle of a read doesn't throw off the fit.
+    static ClockSample sampleClocks() {
+        constexpr int TRIES = 5;
+        ClockSample best{};
+        uint64_t bestWidth = UINT64_MAX;
+        for (int i = 0; i < TRIES; ++i) {
+            timespec monotonicBefore, realtime, monotonicAfter;
+            const auto before = __rdtsc();
+            clock_gettime(CLOCK_MONOTONIC, &monotonicBefore);
+            clock_gettime(CLOCK_REALTIME, &realtime);
+            clock_gettime(CLOCK_MONOTONIC, &monotonicAfter);
+            const auto after = __rdtsc();
+            if (after - before >= bestWidth)
+                continue;
+            bestWidth = after - before;
+            const auto monotonicNs = toNanoseconds(monotonicBefore) / 2 + toNanoseconds(monotonicAfter) / 2;
+            best = {before + bestWidth / 2, monotonicNs,
+                    static_cast<int64_t>(toNanoseconds(realtime) - monotonicNs)};
+        }
+        return best;
+    }
+}
+
+namespace timetools {
+    FastClock::FastClock(TimerFactory &factory, const FastClockOptions &options)
+        : options(options) {
+        factory.calibrateAllCores();
+        unsigned int cpu;
+        __rdtscp(&cpu);
+        const auto frequencyHz = factory.getTscFrequencyHz(cpu & detail::TSC_AUX_CPU_MASK);
+        const auto nanosecondsPerTsc = frequencyHz != 0
+                                           ? 1e9 / static_cast<double>(frequencyHz)
+                                           : 1e9 / static_cast<double>(estimateTscFrequency().frequencyHz);
+
+        const auto sample = detail::sampleClocks();
+        baseTsc.store(sample.tsc, std::memory_order_relaxed);
+        baseMonotonicNs.store(sample.monotonicNs, std::memory_order_relaxed);
+        realtimeOffsetNs.store(sample.realtimeOffsetNs, std::memory_order_relaxed);
+        nanosecondsPerTsc_shl32.store(static_cast<uint64_t>(nanosecondsPerTsc * 0x1p32), std::memory_order_relaxed);
+        sequence.store(2, std::memory_order_release);
+        refitter = std::thread(&FastClock::refitLoop, this, nanosecondsPerTsc);
+    }
+
+    FastClock::~FastClock() {
+        {
+            std::lock_guard lock(stopMutex);
+            stopping = true;
+        }
+        stopCondition.notify_one();
+        refitter.join();
+    }
+
+    void FastClock::refitLoop(double nanosecondsPerTsc) {
+        // The rate is fitted over the last few seconds of samples, which is long enough to make the endpoints'
+        // error negligible and short enough to follow NTP's frequency corrections.
+        constexpr size_t HISTORY = 64;
+        std::vector<detail::ClockSample> history;
+        history.reserve(HISTORY);
+        history.push_back(detail::sampleClocks());
+        size_t oldest = 0;
+
+        const auto interval = std::chrono::nanoseconds(options.refitIntervalNanoseconds);
+        std::unique_lock lock(stopMutex);
+        while (!stopCondition.wait_for(lock, interval, [this]() { return stopping; })) {
+            const auto sample = detail::sampleClocks();
+            const auto &first = history[oldest];
+            if (sample.tsc > first.tsc && sample.monotonicNs > first.monotonicNs)
+                nanosecondsPerTsc = static_cast<double>(sample.monotonicNs - first.monotonicNs)
+                                    / static_cast<double>(sample.tsc - first.tsc);
+            if (history.size() < HISTORY) {
+                history.push_back(sample);
+            } else {
+                history[oldest] = sample;
+                oldest = (oldest + 1) % HISTORY;
+            }
+
+            const auto predictedNs = toMonotonicNanoseconds(sample.tsc);
+            const auto errorNs = static_cast<int64_t>(predictedNs - sample.monotonicNs);
+            lastErrorNs.store(errorNs, std::memory_order_relaxed);
+
+            // Aim to have worked off the error by the next refit, without changing the rate by more than the limit.
+            uint64_t newBaseNs = predictedNs;
+            const auto intervalNs = static_cast<double>(options.refitIntervalNanoseconds);
+            auto correction = -static_cast<double>(errorNs) / intervalNs;
+            if (static_cast<uint64_t>(std::abs(errorNs)) > options.stepThresholdNanoseconds) {
+                newBaseNs = sample.monotonicNs;
+                correction = 0;
+                stepCount.fetch_add(1, std::memory_order_relaxed);
+            }
+            const auto slewLimit = options.maximumSlewPpm / 1e6;
+            correction = std::clamp(correction, -slewLimit, slewLimit);
+            const auto newRate_shl32 = static_cast<uint64_t>(nanosecondsPerTsc * (1 + correction) * 0x1p32);
+
+            const auto oldSequence = sequence.load(std::memory_order_relaxed);
+            sequence.store(oldSequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            baseTsc.store(sample.tsc, std::memory_order_relaxed);
+            baseMonotonicNs.store(newBaseNs, std::memory_order_relaxed);
+            realtimeOffsetNs.store(sample.realtimeOffsetNs, std::memory_order_relaxed);
+            nanosecondsPerTsc_shl32.store(newRate_shl32, std::memory_order_relaxed);
+            sequence.store(oldSequence + 2, std::memory_order_release);
+        }
+    }
+}
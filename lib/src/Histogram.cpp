@@ -0,0 +1,218 @@
+#include "Histogram.h"
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <stdexcept>
+
+namespace timetools::detail {
+    static std::mutex threadIndexMutex;
+    static std::vector<unsigned int> freeThreadIndexes;
+    static unsigned int nextThreadIndex = 0;
+
+    unsigned int acquireThreadIndex() {
+        std::lock_guard lock(threadIndexMutex);
+        if (freeThreadIndexes.empty())
+            return nextThreadIndex++;
+        // Hand out the smallest free index so that indexes stay dense.
+        const auto smallest = std::min_element(freeThreadIndexes.begin(), freeThreadIndexes.end());
+        const auto index = *smallest;
+        freeThreadIndexes.erase(smallest);
+        return index;
+    }
+
+    void releaseThreadIndex(const unsigned int index) {
+        std::lock_guard lock(threadIndexMutex);
+        freeThreadIndexes.push_back(index);
+    }
+}
+
+namespace timetools {
+    LatencyHistogram::LatencyHistogram()
+        : counts(std::make_unique<uint64_t[]>(BUCKET_COUNT)) {
+    }
+
+    LatencyHistogram::LatencyHistogram(const LatencyHistogram &other)
+        : counts(std::make_unique<uint64_t[]>(BUCKET_COUNT)) {
+        merge(other);
+    }
+
+    LatencyHistogram &LatencyHistogram::operator=(const LatencyHistogram &other) {
+        if (this != &other) {
+            reset();
+            merge(other);
+        }
+        return *this;
+    }
+
+    uint64_t LatencyHistogram::getBucketLowestValue(const size_t index) {
+        if (index < SUB_BUCKET_COUNT)
+            return index;
+        const auto offset = index - SUB_BUCKET_COUNT;
+        const auto shift = offset / HALF_SUB_BUCKET_COUNT + 1;
+        const auto subBucket = offset % HALF_SUB_BUCKET_COUNT + HALF_SUB_BUCKET_COUNT;
+        return subBucket << shift;
+    }
+
+    uint64_t LatencyHistogram::getBucketHighestValue(const size_t index) {
+        if (index < SUB_BUCKET_COUNT)
+            return index;
+        const auto offset = index - SUB_BUCKET_COUNT;
+        const auto shift = offset / HALF_SUB_BUCKET_COUNT + 1;
+        const auto subBucket = offset % HALF_SUB_BUCKET_COUNT + HALF_SUB_BUCKET_COUNT;
+        // Wraps to UINT64_MAX for the last bucket, which is what we want.
+        return ((subBucket + 1) << shift) - 1;
+    }
+
+    void LatencyHistogram::merge(const LatencyHistogram &other) {
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+            if (const auto count = read(other.counts[i]); count != 0)
+                increase(counts[i], count);
+        }
+        increase(totalCount, other.getCount());
+        if (other.getMinimum() < getMinimum())
+            std::atomic_ref(minimum).store(other.getMinimum(), std::memory_order_relaxed);
+        if (other.getMaximum() > getMaximum())
+            std::atomic_ref(maximum).store(other.getMaximum(), std::memory_order_relaxed);
+    }
+
+    void LatencyHistogram::reset() {
+        for (size_t i = 0; i < BUCKET_COUNT; ++i)
+            std::atomic_ref(counts[i]).store(0, std::memory_order_relaxed);
+        std::atomic_ref(totalCount).store(0, std::memory_order_relaxed);
+        std::atomic_ref(minimum).store(UINT64_MAX, std::memory_order_relaxed);
+        std::atomic_ref(maximum).store(0, std::memory_order_relaxed);
+    }
+
+    double LatencyHistogram::getMean() const {
+        double total = 0;
+        uint64_t count = 0;
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+            const auto bucketCount = read(counts[i]);
+            if (bucketCount == 0)
+                continue;
+            const auto middle = static_cast<double>(getBucketLowestValue(i)) / 2
+                                + static_cast<double>(getBucketHighestValue(i)) / 2;
+            total += middle * static_cast<double>(bucketCount);
+            count += bucketCount;
+        }
+        return count == 0 ? 0 : total / static_cast<double>(count);
+    }
+
+    uint64_t LatencyHistogram::getValueAtPercentile(const double percentile) const {
+        // Sum the buckets rather than trusting totalCount, which may be ahead of them while another thread records.
+        uint64_t count = 0;
+        for (size_t i = 0; i < BUCKET_COUNT; ++i)
+            count += read(counts[i]);
+        if (count == 0)
+            return 0;
+        const auto clamped = std::clamp(percentile, 0.0, 100.0);
+        const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(clamped / 100 * count)));
+        // A record() running alongside may have counted its value but not yet updated the bounds, and
+        // std::clamp() needs them in order.
+        const auto minimumValue = getMinimum();
+        const auto maximumValue = getMaximum();
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+            seen += read(counts[i]);
+            if (seen < rank)
+                continue;
+            const auto value = getBucketHighestValue(i);
+            return minimumValue <= maximumValue ? std::clamp(value, minimumValue, maximumValue) : value;
+        }
+        return getMaximum();
+    }
+
+    static constexpr uint8_t SERIALIZATION_VERSION = 1;
+
+    static void writeVarint(std::vector<uint8_t> &out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<uint8_t>(value) | 0x80);
+            value >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    static uint64_t readVarint(const uint8_t *&data, const uint8_t *end) {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (data == end)
+                throw std::invalid_argument("Truncated histogram");
+            const auto byte = *data++;
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+        throw std::invalid_argument("Malformed histogram varint");
+    }
+
+    // Layout: version, minimum, maximum, non-empty bucket count, then (index delta, count) for each non-empty bucket.
+    std::vector<uint8_t> LatencyHistogram::serialize() const {
+        std::vector<uint8_t> out;
+        out.push_back(SERIALIZATION_VERSION);
+        writeVarint(out, getMinimum());
+        writeVarint(out, getMaximum());
+        uint64_t nonEmpty = 0;
+        for (size_t i = 0; i < BUCKET_COUNT; ++i)
+            nonEmpty += read(counts[i]) != 0;
+        writeVarint(out, nonEmpty);
+        size_t previous = 0;
+        for (size_t i = 0; i < BUCKET_COUNT && nonEmpty > 0; ++i) {
+            const auto count = read(counts[i]);
+            if (count == 0)
+                continue;
+            writeVarint(out, i - previous);
+            writeVarint(out, count);
+            previous = i;
+            --nonEmpty;
+        }
+        return out;
+    }
+
+    LatencyHistogram LatencyHistogram::deserialize(const uint8_t *data, const size_t size) {
+        const auto *end = data + size;
+        if (data == end || *data++ != SERIALIZATION_VERSION)
+            throw std::invalid_argument("Unknown histogram version");
+        LatencyHistogram histogram;
+        histogram.minimum = readVarint(data, end);
+        histogram.maximum = readVarint(data, end);
+        auto nonEmpty = readVarint(data, end);
+        size_t index = 0;
+        while (nonEmpty-- > 0) {
+            index += readVarint(data, end);
+            if (index >= BUCKET_COUNT)
+                throw std::invalid_argument("Histogram bucket out of range");
+            const auto count = readVarint(data, end);
+            histogram.counts[index] += count;
+            histogram.totalCount += count;
+        }
+        return histogram;
+    }
+
+    ShardedLatencyHistogram::ShardedLatencyHistogram()
+        : shards(std::make_unique<std::atomic<LatencyHistogram *>[]>(MAX_SHARDS)) {
+    }
+
+    ShardedLatencyHistogram::~ShardedLatencyHistogram() {
+        for (unsigned int i = 0; i < MAX_SHARDS; ++i)
+            delete shards[i].load();
+    }
+
+    LatencyHistogram &ShardedLatencyHistogram::createShard(const unsigned int index) {
+        auto *created = new LatencyHistogram();
+        LatencyHistogram *existing = nullptr;
+        if (shards[index].compare_exchange_strong(existing, created, std::memory_order_acq_rel))
+            return *created;
+        // Another thread that shares this index got there first.
+        delete created;
+        return *existing;
+    }
+
+    LatencyHistogram ShardedLatencyHistogram::snapshot() const {
+        LatencyHistogram merged;
+        for (unsigned int i = 0; i < MAX_SHARDS; ++i) {
+            if (const auto *shard = shards[i].load(std::memory_order_acquire); shard != nullptr)
+                merged.merge(*shard);
+        }
+        return merged;
+    }
+}
@@ -0,0 +1,134 @@
+#include "JitterMeter.h"
+#include "Utility.h"
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <thread>
+
+namespace timetools {
+    detail::RealtimeSlicing detail::getRealtimeSlicing(const int64_t runtimeMicroseconds,
+                                                       const int64_t periodMicroseconds) {
+        if (runtimeMicroseconds < 0 || periodMicroseconds <= 0 || runtimeMicroseconds >= periodMicroseconds)
+            return {UINT64_MAX, 0};
+        const auto slice = static_cast<uint64_t>(runtimeMicroseconds) * 900;
+        return {slice, static_cast<uint64_t>(periodMicroseconds) * 1000 - slice};
+    }
+
+    static int64_t readMicroseconds(const char *path, const int64_t fallback) {
+        std::ifstream file(path);
+        int64_t value;
+        return file >> value ? value : fallback;
+    }
+
+    static void measureCpu(CpuJitter &result, const TscConversion &conversion, const JitterOptions &options,
+                           const detail::RealtimeSlicing &slicing, std::atomic<size_t> &ready,
+                           const size_t threadCount) {
+        result.error = setThisThreadAffinity(result.cpu);
+        if (result.error == 0 && options.realtimePriority > 0)
+            result.error = setThisThreadFifoRealtimePriority(options.realtimePriority);
+        result.events.reserve(options.maximumEventsPerCpu);
+        // Start together, so that every cpu sees the same interrupts at the same time.
+        ++ready;
+        while (ready.load() < threadCount)
+            std::this_thread::yield();
+        if (result.error != 0)
+            return;
+
+        const auto thresholdTicks = conversion.toTicks(options.thresholdNanoseconds);
+        const auto sliceTicks = slicing.sliceNanoseconds == UINT64_MAX
+                                    ? UINT64_MAX
+                                    : conversion.toTicks(slicing.sliceNanoseconds);
+        auto remainingTicks = conversion.toTicks(options.durationNanoseconds);
+        uint64_t measuredTicks = 0;
+        while (true) {
+            auto last = __rdtsc();
+            const auto start = last;
+            const auto end = start + std::min<uint64_t>(remainingTicks, sliceTicks);
+            while (last < end) {
+                const auto now = __rdtsc();
+                if (now - last > thresholdTicks) [[unlikely]] {
+                    const auto gapNanoseconds = conversion.toNanoseconds(now - last);
+                    result.gaps.record(gapNanoseconds);
+                    result.stolenNanoseconds += gapNanoseconds;
+                    if (result.events.size() < options.maximumEventsPerCpu)
+                        result.events.push_back({last, gapNanoseconds});
+                    else
+                        ++result.droppedEvents;
+                }
+                last = now;
+            }
+            measuredTicks += last - start;
+            remainingTicks -= std::min<uint64_t>(remainingTicks, last - start);
+            if (remainingTicks == 0)
+                break;
+            // Give back the rest of the realtime period, rather than being throttled, and don't count it as a gap.
+            std::this_thread::sleep_for(std::chrono::nanoseconds(slicing.sleepNanoseconds));
+        }
+        result.durationNanoseconds = conversion.toNanoseconds(measuredTicks);
+    }
+
+    JitterReport measureJitter(TimerFactory &factory, const JitterOptions &options) {
+        const auto cpus = options.cpus.empty() ? detail::getOnlineCpus() : options.cpus;
+        factory.calibrateAllCores();
+
+        JitterReport report;
+        report.cpus.resize(cpus.size());
+        std::vector<TscConversion> conversions;
+        for (size_t i = 0; i < cpus.size(); ++i) {
+            report.cpus[i] = {cpus[i], 0, 0, {}, {}, 0, 0};
+            conversions.push_back(factory.createTscConversion(static_cast<unsigned int>(cpus[i])));
+        }
+
+        const auto slicing = options.realtimePriority > 0
+                                 ? detail::getRealtimeSlicing(
+                                     readMicroseconds("/proc/sys/kernel/sched_rt_runtime_us", -1),
+                                     readMicroseconds("/proc/sys/kernel/sched_rt_period_us", 1000000))
+                                 : detail::RealtimeSlicing{UINT64_MAX, 0};
+
+        std::atomic<size_t> ready = 0;
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < cpus.size(); ++i) {
+            threads.emplace_back(measureCpu, std::ref(report.cpus[i]), std::cref(conversions[i]), std::cref(options),
+                                 std::cref(slicing), std::ref(ready), cpus.size());
+        }
+        for (auto &thread: threads)
+            thread.join();
+        return report;
+    }
+
+    std::vector<int> JitterReport::getQuietCpus(const uint64_t maximumGapNanoseconds) const {
+        std::vector<const CpuJitter *> quiet;
+        for (const auto &cpu: cpus) {
+            if (cpu.error == 0 && cpu.gaps.getMaximum() <= maximumGapNanoseconds)
+                quiet.push_back(&cpu);
+        }
+        std::stable_sort(quiet.begin(), quiet.end(), [](const CpuJitter *left, const CpuJitter *right) {
+            return left->getStolenFraction() < right->getStolenFraction();
+        });
+        std::vector<int> result;
+        for (const auto *cpu: quiet)
+            result.push_back(cpu->cpu);
+        return result;
+    }
+
+    void JitterReport::print(std::ostream &out) const {
+        const auto flags = out.flags();
+        const auto precision = out.precision();
+        out << "cpu      gaps   p50 ns   p99 ns p99.9 ns   max ns  lost\n";
+        for (const auto &cpu: cpus) {
+            out << std::setw(3) << cpu.cpu;
+            if (cpu.error != 0) {
+                out << "  couldn't pin or prioritize: error " << cpu.error << "\n";
+                continue;
+            }
+            out << std::setw(10) << cpu.gaps.getCount()
+                    << std::setw(9) << cpu.gaps.getValueAtPercentile(50)
+                    << std::setw(9) << cpu.gaps.getValueAtPercentile(99)
+                    << std::setw(9) << cpu.gaps.getValueAtPercentile(99.9)
+                    << std::setw(9) << cpu.gaps.getMaximum()
+                    << std::setw(9) << std::fixed << std::setprecision(4) << cpu.getStolenFraction() * 100 << "%\n";
+            out.flags(flags);
+            out.precision(precision);
+        }
+    }
+}
@@ -0,0 +1,112 @@
+#include "LoadGenerator.h"
+#include "StartBarrier.h"
+#include <algorithm>
+#include <iomanip>
+#include <mutex>
+#include <random>
+#include <thread>
+
+namespace timetools {
+    std::vector<uint64_t> makeLoadSchedule(const LoadOptions &options) {
+        if (!options.trace.empty())
+            return options.trace;
+        std::vector<uint64_t> schedule;
+        if (!(options.requestsPerSecond > 0))
+            return schedule;
+        const auto intervalNanoseconds = 1e9 / options.requestsPerSecond;
+        schedule.reserve(static_cast<size_t>(static_cast<double>(options.durationNanoseconds) / intervalNanoseconds));
+        std::mt19937_64 random(options.seed);
+        std::exponential_distribution<double> gaps(1 / intervalNanoseconds);
+        // Accumulate in double, so that rounding doesn't add up over millions of requests.
+        double nanoseconds = 0;
+        while (nanoseconds < static_cast<double>(options.durationNanoseconds)) {
+            schedule.push_back(static_cast<uint64_t>(nanoseconds));
+            nanoseconds += options.arrivals == ArrivalProcess::Poisson ? gaps(random) : intervalNanoseconds;
+        }
+        return schedule;
+    }
+
+    LoadReport generateLoad(TimerFactory &factory, const LoadOptions &options,
+                            const std::function<void(uint64_t request)> &send) {
+        const auto schedule = makeLoadSchedule(options);
+        const auto conversion = factory.createTscConversion();
+        const auto senderCount = std::max<size_t>(options.cpus.size(), 1);
+
+        LoadReport report{};
+        report.requests = schedule.size();
+        if (options.trace.empty()) {
+            report.targetRequestsPerSecond = options.requestsPerSecond;
+        } else if (schedule.back() > schedule.front()) {
+            report.targetRequestsPerSecond = static_cast<double>(schedule.size() - 1) * 1e9
+                                             / static_cast<double>(schedule.back() - schedule.front());
+        } else {
+            // Everything is sent at once, so there's no rate to aim for.
+            report.targetRequestsPerSecond = 0;
+        }
+        std::mutex reportMutex;
+        uint64_t lastCompletionTicks = 0;
+        StartBarrier barrier(factory, static_cast<unsigned int>(senderCount));
+        std::vector<std::thread> senders;
+        for (size_t sender = 0; sender < senderCount; ++sender) {
+            senders.emplace_back([&, sender]() {
+                int error = 0;
+                if (!options.cpus.empty())
+                    error = setThisThreadAffinity(options.cpus[sender]);
+                // Created after pinning, to measure the sending core's wait error.
+                const auto waiter = factory.createWaiter(options.strategy);
+                LatencyHistogram latency, sendDelay;
+                uint64_t completionTsc = 0;
+                const auto startTsc = barrier.arriveAndWait();
+                for (auto request = sender; request < schedule.size(); request += senderCount) {
+                    const auto intendedTsc = startTsc + conversion.toTicks(schedule[request]);
+                    waiter.waitUntilTsc(intendedTsc);
+                    const auto sentTsc = __rdtsc();
+                    send(request);
+                    completionTsc = __rdtsc();
+                    // The sleeping strategies can return a few ticks early, so don't let a fast send wrap around.
+                    sendDelay.record(conversion.toNanoseconds(sentTsc > intendedTsc ? sentTsc - intendedTsc : 0));
+                    latency.record(
+                        conversion.toNanoseconds(completionTsc > intendedTsc ? completionTsc - intendedTsc : 0));
+                }
+                std::lock_guard lock(reportMutex);
+                report.latencyNanoseconds.merge(latency);
+                report.sendDelayNanoseconds.merge(sendDelay);
+                if (report.error == 0)
+                    report.error = error;
+                if (completionTsc > startTsc)
+                    lastCompletionTicks = std::max(lastCompletionTicks, completionTsc - startTsc);
+            });
+        }
+        for (auto &sender: senders)
+            sender.join();
+
+        report.elapsedNanoseconds = conversion.toNanoseconds(lastCompletionTicks);
+        if (report.elapsedNanoseconds != 0) {
+            report.achievedRequestsPerSecond = static_cast<double>(report.requests) * 1e9
+                                               / static_cast<double>(report.elapsedNanoseconds);
+        }
+        return report;
+    }
+
+    void LoadReport::print(std::ostream &out) const {
+        const auto flags = out.flags();
+        const auto precision = out.precision();
+        out << std::fixed << std::setprecision(0) << requests << " requests, target " << targetRequestsPerSecond
+                << "/s, achieved " << achievedRequestsPerSecond << "/s\n";
+        out.flags(flags);
+        out.precision(precision);
+        out << "              p50 ns   p99 ns p99.9 ns   max ns\n";
+        const auto printRow = [&out](const char *name, const LatencyHistogram &histogram) {
+            out << std::left << std::setw(12) << name << std::right
+                    << std::setw(9) << histogram.getValueAtPercentile(50)
+                    << std::setw(9) << histogram.getValueAtPercentile(99)
+                    << std::setw(9) << histogram.getValueAtPercentile(99.9)
+                    << std::setw(9) << histogram.getMaximum() << "\n";
+        };
+        printRow("latency", latencyNanoseconds);
+        printRow("send delay", sendDelayNanoseconds);
+        out.flags(flags);
+        if (error != 0)
+            out << "couldn't pin a sender: error " << error << "\n";
+    }
+}
@@ -0,0 +1,110 @@
+#include "timetools.h"
+#include "Utility.h"
+#include <immintrin.h>
+#include <thread>
+#include <vector>
+
+namespace timetools::detail {
+    struct TscOffset {
+        int64_t offsetTicks;
+        uint64_t uncertaintyTicks;
+    };
+
+    // The cache line the two cores bounce between them. Odd sequence numbers are the reference's pings,
+    // even ones are the other core's replies.
+    struct alignas(64) PingPongLine {
+        std::atomic<uint64_t> sequence = 0;
+        std::atomic<uint64_t> replyTsc = 0;
+        // Set if the other core's thread couldn't be pinned.
+        std::atomic<bool> abandoned = false;
+    };
+
+    static uint64_t readTscInOrder() {
+        _mm_lfence();
+        const auto tsc = __rdtsc();
+        _mm_lfence();
+        return tsc;
+    }
+
+    // Must be called on the reference core, while another thread runs answerPings() on the other core.
+    // Each round, the other core's reading must fall between the two reference readings around it, which bounds
+    // the offset from both sides. Taking the tightest bounds over every round gives the estimate.
+    static TscOffset sendPings(PingPongLine &line, const int rounds) {
+        int64_t lowest = INT64_MIN, highest = INT64_MAX;
+        // Kept in case skew makes the bounds cross, in which case the shortest round trip is the best we have.
+        uint64_t shortestRoundTrip = UINT64_MAX;
+        int64_t shortestRoundTripOffset = 0;
+        for (uint64_t round = 0; round < static_cast<uint64_t>(rounds); ++round) {
+            const auto before = readTscInOrder();
+            line.sequence.store(2 * round + 1, std::memory_order_release);
+            while (line.sequence.load(std::memory_order_acquire) != 2 * round + 2) {
+                if (line.abandoned.load(std::memory_order_relaxed))
+                    return {0, UINT64_MAX};
+                _mm_pause();
+            }
+            const auto after = readTscInOrder();
+            const auto reply = line.replyTsc.load(std::memory_order_relaxed);
+            lowest = std::max(lowest, static_cast<int64_t>(reply - after));
+            highest = std::min(highest, static_cast<int64_t>(reply - before));
+            if (after - before < shortestRoundTrip) {
+                shortestRoundTrip = after - before;
+                shortestRoundTripOffset = static_cast<int64_t>(reply - before - shortestRoundTrip / 2);
+            }
+        }
+        line.sequence.store(UINT64_MAX, std::memory_order_release);
+        if (lowest <= highest)
+            return {lowest + (highest - lowest) / 2, static_cast<uint64_t>(highest - lowest) / 2};
+        return {shortestRoundTripOffset, shortestRoundTrip / 2};
+    }
+
+    static void answerPings(PingPongLine &line) {
+        for (uint64_t round = 0;; ++round) {
+            uint64_t sequence;
+            while ((sequence = line.sequence.load(std::memory_order_acquire)) != 2 * round + 1) {
+                if (sequence == UINT64_MAX)
+                    return;
+                _mm_pause();
+            }
+            line.replyTsc.store(readTscInOrder(), std::memory_order_relaxed);
+            line.sequence.store(2 * round + 2, std::memory_order_release);
+        }
+    }
+}
+
+namespace timetools {
+    void TimerFactory::measureTscOffsets() {
+        constexpr int ROUNDS = 5000;
+        auto table = std::make_shared<TscOffsetTable>();
+        table->offsetTicks.assign(coreCount, 0);
+        table->uncertaintyTicks.assign(coreCount, UINT64_MAX);
+        const auto cpus = detail::getOnlineCpus();
+        if (!cpus.empty() && static_cast<unsigned int>(cpus.front()) < coreCount) {
+            table->referenceCore = cpus.front();
+            table->uncertaintyTicks[table->referenceCore] = 0;
+            // One core at a time, so that the pairs don't disturb each other.
+            for (const auto cpu: cpus) {
+                if (cpu == cpus.front() || static_cast<unsigned int>(cpu) >= coreCount)
+                    continue;
+                detail::PingPongLine line;
+                detail::TscOffset offset{0, UINT64_MAX};
+                std::thread responder([&line, cpu]() {
+                    if (setThisThreadAffinity(cpu) == 0)
+                        detail::answerPings(line);
+                    else
+                        line.abandoned.store(true, std::memory_order_relaxed);
+                });
+                std::thread reference([&line, &offset, &table]() {
+                    if (setThisThreadAffinity(static_cast<int>(table->referenceCore)) == 0)
+                        offset = detail::sendPings(line, ROUNDS);
+                    else
+                        line.sequence.store(UINT64_MAX, std::memory_order_release);
+                });
+                reference.join();
+                responder.join();
+                table->offsetTicks[cpu] = offset.offsetTicks;
+                table->uncertaintyTicks[cpu] = offset.uncertaintyTicks;
+            }
+        }
+        tscOffsets.store(std::move(table), std::memory_order_release);
+    }
+}
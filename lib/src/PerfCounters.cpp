@@ -0,0 +1,135 @@
+#include "PerfCounters.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace timetools {
+    std::vector<PerfEventSpec> getDefaultPerfEvents() {
+        return {
+            PerfEvents::CYCLES, PerfEvents::INSTRUCTIONS, PerfEvents::LLC_MISSES, PerfEvents::BRANCH_MISSES,
+            PerfEvents::CONTEXT_SWITCHES, PerfEvents::PAGE_FAULTS
+        };
+    }
+
+    static int openPerfEvent(const PerfEventSpec &spec, const int groupFd) {
+        perf_event_attr attributes;
+        std::memset(&attributes, 0, sizeof(attributes));
+        attributes.size = sizeof(attributes);
+        attributes.type = spec.type;
+        attributes.config = spec.config;
+        attributes.disabled = 1;
+        // Counting only user space is allowed at the default perf_event_paranoid of 2.
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        return static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, groupFd, PERF_FLAG_FD_CLOEXEC));
+    }
+
+    CounterStopwatch::CounterStopwatch(TimerFactory &factory, const std::vector<PerfEventSpec> &events)
+        : stopwatch(factory.createStopwatch()) {
+        const auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        int groupFd = -1;
+        for (const auto &spec: events) {
+            Counter counter;
+            counter.spec = spec;
+            // Group the events so that they're scheduled onto the PMU together, but don't let one that
+            // won't join the group stop it from being counted at all.
+            counter.fd = openPerfEvent(spec, groupFd);
+            if (counter.fd < 0 && groupFd >= 0)
+                counter.fd = openPerfEvent(spec, -1);
+            if (counter.fd >= 0) {
+                if (groupFd < 0)
+                    groupFd = counter.fd;
+                void *page = mmap(nullptr, pageSize, PROT_READ, MAP_SHARED, counter.fd, 0);
+                if (page != MAP_FAILED)
+                    counter.page = static_cast<perf_event_mmap_page *>(page);
+                ioctl(counter.fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+            counters.push_back(counter);
+        }
+    }
+
+    CounterStopwatch::~CounterStopwatch() {
+        const auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        for (const auto &counter: counters) {
+            if (counter.page != nullptr)
+                munmap(counter.page, pageSize);
+            if (counter.fd >= 0)
+                close(counter.fd);
+        }
+    }
+
+    // See the description of perf_event_mmap_page in perf_event_open(2).
+    uint64_t CounterStopwatch::readCounter(const Counter &counter) {
+        if (const auto *page = counter.page; page != nullptr && page->cap_user_rdpmc) {
+            while (true) {
+                const auto sequence = page->lock;
+                std::atomic_signal_fence(std::memory_order_acquire);
+                const auto index = page->index;
+                auto value = static_cast<uint64_t>(page->offset);
+                if (index == 0)
+                    break; // Not currently on a hardware counter.
+                const auto width = page->pmc_width;
+                auto count = __rdpmc(static_cast<int>(index - 1));
+                count <<= 64 - width;
+                count >>= 64 - width;
+                value += count;
+                std::atomic_signal_fence(std::memory_order_acquire);
+                if (page->lock == sequence)
+                    return value;
+            }
+        }
+        uint64_t value = 0;
+        if (read(counter.fd, &value, sizeof(value)) != sizeof(value))
+            return 0;
+        return value;
+    }
+
+    void CounterStopwatch::readAll(const bool starting) {
+        for (auto &counter: counters) {
+            if (counter.fd < 0)
+                continue;
+            const auto value = readCounter(counter);
+            if (starting)
+                counter.startValue = value;
+            else
+                counter.total += value - counter.startValue;
+        }
+    }
+
+    void CounterStopwatch::reset() {
+        stopwatch.reset();
+        for (auto &counter: counters)
+            counter.total = 0;
+    }
+
+    bool CounterStopwatch::hasCounters() const {
+        return std::any_of(counters.begin(), counters.end(), [](const Counter &counter) { return counter.fd >= 0; });
+    }
+
+    CounterReport CounterStopwatch::report(const uint64_t operations) const {
+        const auto divisor = static_cast<double>(std::max<uint64_t>(operations, 1));
+        CounterReport report;
+        report.elapsedNanoseconds = stopwatch.getElapsedNanoseconds();
+        report.nanosecondsPerOperation = static_cast<double>(report.elapsedNanoseconds) / divisor;
+        double cycles = NAN, instructions = NAN;
+        for (const auto &counter: counters) {
+            const auto available = counter.fd >= 0;
+            report.counters.push_back({
+                counter.spec.name, available, counter.total, static_cast<double>(counter.total) / divisor
+            });
+            if (!available || counter.spec.type != PERF_TYPE_HARDWARE)
+                continue;
+            if (counter.spec.config == PERF_COUNT_HW_CPU_CYCLES)
+                cycles = static_cast<double>(counter.total);
+            else if (counter.spec.config == PERF_COUNT_HW_INSTRUCTIONS)
+                instructions = static_cast<double>(counter.total);
+        }
+        report.instructionsPerCycle = instructions / cycles;
+        return report;
+    }
+}
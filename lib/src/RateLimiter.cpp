@@ -0,0 +1,38 @@
+#include "RateLimiter.h"
+#include <stdexcept>
+
+namespace timetools {
+    RateLimiter::RateLimiter(TimerFactory &factory, const double tokensPerSecond, const uint64_t burst,
+                             const WaitStrategy strategy)
+        : waiter(factory.createWaiter(strategy)), epochTsc(__rdtsc()), burst(burst) {
+        if (!(tokensPerSecond > 0) || burst == 0)
+            throw std::invalid_argument("A rate limiter needs a positive rate and burst");
+        // Creating the waiter calibrated this core, so this is a lookup.
+        const auto frequencyHz = factory.createTscConversion().toTicks(1000000000);
+        constexpr double SECONDS_PER_YEAR = 365.25 * 24 * 3600;
+        if (static_cast<double>(burst) / tokensPerSecond > SECONDS_PER_YEAR)
+            throw std::invalid_argument("The rate limiter's burst would take over a year to refill");
+        const auto interval = static_cast<double>(frequencyHz) / tokensPerSecond * (1 << FRACTION_BITS);
+        intervalTsc_shl4 = std::max<uint64_t>(static_cast<uint64_t>(interval), 1);
+        capacityTsc_shl4 = intervalTsc_shl4 * burst;
+    }
+
+    ShardedRateLimiter::ShardedRateLimiter(TimerFactory &factory, const double tokensPerSecond, const uint64_t burst,
+                                           const unsigned int shardCount, const WaitStrategy strategy) {
+        const auto count = std::clamp<uint64_t>(shardCount, 1, std::max<uint64_t>(burst, 1));
+        for (uint64_t i = 0; i < count; ++i) {
+            // Hand out the remainder of the burst to the first shards, so the last one is the smallest.
+            const auto shardBurst = burst / count + (i < burst % count ? 1 : 0);
+            shards.push_back(std::make_unique<RateLimiter>(factory, tokensPerSecond * static_cast<double>(shardBurst)
+                                                                    / static_cast<double>(burst),
+                                                           shardBurst, strategy));
+        }
+    }
+
+    uint64_t ShardedRateLimiter::getAvailableTokens() const {
+        uint64_t available = 0;
+        for (const auto &shard: shards)
+            available += shard->getAvailableTokens();
+        return available;
+    }
+}
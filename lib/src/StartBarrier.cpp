@@ -0,0 +1,75 @@
+#include "StartBarrier.h"
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+
+namespace timetools {
+    StartBarrier::StartBarrier(TimerFactory &factory, const unsigned int participants,
+                               const uint64_t leadNanoseconds, const WaitStrategy strategy)
+        : factory(factory), waiter(factory.createWaiter(strategy)), participants(participants),
+          tscOffsets(factory.getTscOffsets()) {
+        if (participants == 0)
+            throw std::invalid_argument("A barrier needs at least one participant");
+        // Creating the waiter calibrated this core, so this is a lookup.
+        const auto conversion = factory.createTscConversion();
+        fallbackFrequencyHz = conversion.toTicks(1000000000);
+        leadTsc = conversion.toTicks(leadNanoseconds);
+        departures = std::make_unique<Departure[]>(participants);
+    }
+
+    uint64_t StartBarrier::arriveAndWait() {
+        const auto currentRound = round.load(std::memory_order_acquire);
+        const auto index = arrived.fetch_add(1, std::memory_order_acq_rel);
+        uint64_t deadline;
+        if (index + 1 == participants) {
+            measureLastRound();
+            deadline = __rdtsc() + leadTsc;
+            deadlineTsc = deadline;
+            arrived.store(0, std::memory_order_relaxed);
+            round.store(currentRound + 1, std::memory_order_release);
+        } else {
+            // Give up the cpu now and then, in case a participant still to arrive is waiting for it.
+            for (unsigned int spins = 1; round.load(std::memory_order_acquire) == currentRound; ++spins) {
+                _mm_pause();
+                if (spins % 1024 == 0)
+                    std::this_thread::yield();
+            }
+            // Not written again until this thread arrives for the next round.
+            deadline = deadlineTsc;
+        }
+        waiter.waitUntilTsc(deadline);
+        auto &departure = departures[index];
+        departure.tsc = __rdtscp(&departure.cpu);
+        return deadline;
+    }
+
+    void StartBarrier::measureLastRound() {
+        const auto released = round.load(std::memory_order_acquire);
+        if (released == 0 || released == measuredRound)
+            return;
+        measuredRound = released;
+        double earliest = INFINITY, latest = -INFINITY, maximumLateness = 0;
+        for (unsigned int i = 0; i < participants; ++i) {
+            const auto cpu = departures[i].cpu & detail::TSC_AUX_CPU_MASK;
+            auto frequencyHz = cpu < factory.getCoreCount() ? factory.getTscFrequencyHz(cpu) : 0;
+            if (frequencyHz == 0)
+                frequencyHz = fallbackFrequencyHz;
+            const auto nanosecondsPerTick = 1e9 / static_cast<double>(frequencyHz);
+            // Each participant waited for its own TSC to reach the deadline...
+            const auto lateTicks = static_cast<int64_t>(departures[i].tsc - deadlineTsc);
+            maximumLateness = std::max(maximumLateness, static_cast<double>(lateTicks) * nanosecondsPerTick);
+            // ...but comparing them with each other needs one timebase.
+            const auto offsetTicks = tscOffsets ? tscOffsets->getOffsetTicks(cpu, tscOffsets->referenceCore) : 0;
+            const auto departure = static_cast<double>(lateTicks + offsetTicks) * nanosecondsPerTick;
+            earliest = std::min(earliest, departure);
+            latest = std::max(latest, departure);
+        }
+        lastRelease = {deadlineTsc, static_cast<uint64_t>(latest - earliest), static_cast<uint64_t>(maximumLateness)};
+        skews.record(lastRelease.skewNanoseconds);
+    }
+
+    BarrierRelease StartBarrier::getLastRelease() {
+        measureLastRound();
+        return lastRelease;
+    }
+}
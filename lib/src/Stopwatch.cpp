@@ -1,63 +1,210 @@
-#include <algorithm>
-#include <cstring>
-
 #include "timetools.h"
 #include "Utility.h"
 #include <immintrin.h>
 #include <thread>
-#include <cassert>
+#include <algorithm>
+#include <stdexcept>
 #include <vector>
 
 namespace timetools {
 
-    TimerFactory::TimerFactory() {
-        const auto coreCount = std::thread::hardware_concurrency();
-        tscPerNanosecond_shl25perCore = new uint64_t[coreCount];
-        std::memset(tscPerNanosecond_shl25perCore, 0, coreCount * sizeof(uint64_t));
+    TimerFactory::TimerFactory(const TimerFactoryOptions &options)
+        : coreCount(detail::getPossibleCpuCount()), compensateOverhead(options.compensateOverhead) {
+        tscPerNanosecond_shl25perCore = std::make_unique<std::atomic<uint64_t>[]>(coreCount);
+        if (!options.calibrationCachePath.empty())
+            calibrationCache = std::make_unique<detail::CalibrationCache>(options.calibrationCachePath);
+        if (options.eagerCalibration) {
+            calibrateAllCores();
+            // Also measure the default waiter, so that createWaiter() is just a lookup.
+            if (compensateOverhead)
+                (void) createWaiter();
+        }
+        if (options.measureTscOffsets)
+            measureTscOffsets();
+    }
+
+    TimerFactory::~TimerFactory() = default;
+
+    // Must be called on the given core.
+    uint64_t TimerFactory::calibrateCore(const unsigned int coreId) {
+        auto tscPerSecond = calibrationCache ? calibrationCache->lookup(coreId) : 0;
+        if (tscPerSecond == 0) {
+            tscPerSecond = estimateTscFrequency().frequencyHz;
+            if (calibrationCache)
+                calibrationCache->store(coreId, tscPerSecond);
+        }
+
+        // (x << 16) / 1953125ll is the same as (x << 25) / 1000000000ll.
+        const auto tscPerNanosecond_shl25 = static_cast<uint64_t>((tscPerSecond << 16) / 1953125ll);
+        if (coreId >= coreCount)
+            return tscPerNanosecond_shl25;
+
+        // If another thread on this core got there first, agree with it.
+        uint64_t existing = 0;
+        if (tscPerNanosecond_shl25perCore[coreId].compare_exchange_strong(existing, tscPerNanosecond_shl25,
+                                                                         std::memory_order_acq_rel))
+            return tscPerNanosecond_shl25;
+        return existing;
+    }
+
+    void TimerFactory::calibrateAllCores() {
+        std::vector<std::thread> threads;
+        for (const auto cpu: detail::getOnlineCpus()) {
+            if (static_cast<unsigned int>(cpu) >= coreCount
+                || tscPerNanosecond_shl25perCore[cpu].load(std::memory_order_acquire) != 0)
+                continue;
+            threads.emplace_back([this, cpu]() {
+                if (setThisThreadAffinity(cpu) == 0)
+                    calibrateCore(cpu);
+            });
+        }
+        for (auto &thread: threads)
+            thread.join();
+    }
+
+    uint64_t TimerFactory::getTscFrequencyHz(const unsigned int coreId) const {
+        if (coreId >= coreCount)
+            return 0;
+        const auto tscPerNanosecond_shl25 = tscPerNanosecond_shl25perCore[coreId].load(std::memory_order_acquire);
+        return (tscPerNanosecond_shl25 * 1953125ull) >> 16;
     }
 
     uint64_t TimerFactory::getTscRateForCurrentCore() {
         unsigned int coreId;
         __rdtscp(&coreId);
-        const auto existingTiming = tscPerNanosecond_shl25perCore[coreId];
-        if (existingTiming != 0)
-            return existingTiming;
-        const auto tscPerSecond = detail::estimateTscFrequencyHz();
+        coreId &= detail::TSC_AUX_CPU_MASK;
+        if (coreId < coreCount) {
+            const auto existingTiming = tscPerNanosecond_shl25perCore[coreId].load(std::memory_order_acquire);
+            if (existingTiming != 0)
+                return existingTiming;
+        }
+        return calibrateCore(coreId);
+    }
 
-        // (x << 16) / 1953125ll is the same as (x << 25) / 1000000000ll.
-        const auto tscPerNanosecond_shl25 = static_cast<int64_t>((tscPerSecond << 16) / 1953125ll);
+    Waiter TimerFactory::createWaiter(const WaitStrategy strategy) {
+        const auto hybridSpinNs = strategy == WaitStrategy::Hybrid ? getSleepWakeupLatencyNs() : 0;
+        // Assume the waiter will be used on the current core.
+        Waiter waiter(getTscRateForCurrentCore(), strategy, hybridSpinNs);
+        if (compensateOverhead)
+            waiter.errorModel = getWaitErrorModel(waiter.getStrategy());
+        return waiter;
+    }
 
-        return tscPerNanosecond_shl25perCore[coreId] = tscPerNanosecond_shl25;
+    TscConversion TimerFactory::createTscConversion() {
+        return TscConversion(getTscRateForCurrentCore());
     }
 
-    Stopwatch TimerFactory::createStopwatch() {
-        // Assume the stopwatch will be used on the current core.
-        return Stopwatch(getTscRateForCurrentCore());
+    TscConversion TimerFactory::createTscConversion(const unsigned int coreId) {
+        if (coreId < coreCount) {
+            const auto tscPerNanosecond_shl25 = tscPerNanosecond_shl25perCore[coreId].load(std::memory_order_acquire);
+            if (tscPerNanosecond_shl25 != 0)
+                return TscConversion(tscPerNanosecond_shl25);
+        }
+        return createTscConversion();
     }
 
-    Waiter TimerFactory::createWaiter() {
-        // Assume the waiter will be used on the current core.
-        return Waiter(getTscRateForCurrentCore());
+    Pacer TimerFactory::createPacer(const double eventsPerSecond, const uint64_t eventsPerDeadline,
+                                    const WaitStrategy strategy) {
+        if (!(eventsPerSecond > 0) || eventsPerDeadline == 0)
+            throw std::invalid_argument("A pacer needs a positive rate and batch size");
+        const auto waiter = createWaiter(strategy);
+        const auto tscPerNanosecond_shl25 = waiter.tscPerNanosecond_shl25;
+        const auto tscPerSecond = static_cast<double>(tscPerNanosecond_shl25) * 1e9 / (1 << 25);
+        const auto periodTsc = static_cast<double>(eventsPerDeadline) * tscPerSecond / eventsPerSecond;
+        return Pacer(waiter, tscPerNanosecond_shl25, periodTsc, eventsPerDeadline);
     }
 
-    void Stopwatch::start() {
-        startTsc = __rdtscp(&startCpu);
-        _mm_lfence();
+    uint64_t TimerFactory::estimateStartStopOverheadTsc() {
+        return getStopwatchOverheadTicks<RdtscpClock, MemoryFence>();
     }
 
-    void Stopwatch::stop() {
-        unsigned int stopCpu;
-        _mm_mfence();
-        const auto stopTsc = __rdtscp(&stopCpu);
-        assert(startCpu == stopCpu); // This stopwatch is unreliable if the CPU changes.
-        elapsedTsc += stopTsc - startTsc;
+    WaitErrorModel TimerFactory::getWaitErrorModel(const WaitStrategy strategy) {
+        switch (strategy) {
+            case WaitStrategy::PauseLoop:
+            case WaitStrategy::UnrolledPauseLoop:
+            case WaitStrategy::Rdtscp:
+            case WaitStrategy::Tpause:
+                break;
+            default:
+                return {};
+        }
+        // Held while measuring so that concurrent callers don't disturb each other's measurements.
+        std::lock_guard lock(waitErrorModelsMutex);
+        if (const auto existing = waitErrorModels.find(strategy); existing != waitErrorModels.end())
+            return existing->second;
+        const auto model = measureWaitErrorModel(Waiter(getTscRateForCurrentCore(), strategy, 0));
+        waitErrorModels.emplace(strategy, model);
+        return model;
+    }
+
+    // Like the SweepWait benchmark, but only at the middle of each of the model's buckets.
+    WaitErrorModel TimerFactory::measureWaitErrorModel(Waiter waiter) {
+        constexpr uint64_t BUDGET_NS_PER_BUCKET = 2000000;
+        constexpr uint64_t MINIMUM_TRIALS = 5;
+        constexpr uint64_t MAXIMUM_TRIALS = 101;
+        auto stopwatch = createStopwatch<RdtscpClock, MemoryFence>();
+        WaitErrorModel model;
+        std::vector<uint64_t> actualTsc;
+        actualTsc.reserve(MAXIMUM_TRIALS);
+        for (int bucket = 0; bucket < WaitErrorModel::BUCKET_COUNT; ++bucket) {
+            const uint64_t waitNs = 3ull << (bucket + WaitErrorModel::MIN_DURATION_LOG2 - 1);
+            const auto trials = std::clamp(BUDGET_NS_PER_BUCKET / waitNs, MINIMUM_TRIALS, MAXIMUM_TRIALS);
+            actualTsc.clear();
+            for (uint64_t trial = 0; trial < trials; ++trial) {
+                stopwatch.reset();
+                stopwatch.start();
+                waiter.busyWait(waitNs);
+                stopwatch.stop();
+                actualTsc.push_back(stopwatch.elapsedTsc);
+            }
+            std::nth_element(actualTsc.begin(), actualTsc.begin() + trials / 2, actualTsc.end());
+            const auto medianTsc = actualTsc[trials / 2];
+            const auto intendedTsc = waiter.conversion.toTicks(waitNs);
+            model.correctionTsc[bucket] = medianTsc > intendedTsc ? medianTsc - intendedTsc : 0;
+        }
+        return model;
+    }
+
+    uint64_t TimerFactory::getSleepWakeupLatencyNs() {
+        if (const auto measured = sleepWakeupLatencyNs.load(std::memory_order_acquire); measured != 0)
+            return measured;
+
+        // Sleep briefly many times and see how late we wake up.
+        constexpr int TRIALS = 100;
+        constexpr long SLEEP_NS = 20000;
+        std::vector<int64_t> latenessNs;
+        latenessNs.reserve(TRIALS);
+        for (int trial = 0; trial < TRIALS; ++trial) {
+            timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_nsec += SLEEP_NS;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_nsec -= 1000000000;
+                deadline.tv_sec++;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr);
+            timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            latenessNs.push_back((now.tv_sec - deadline.tv_sec) * 1000000000ll + now.tv_nsec - deadline.tv_nsec);
+        }
+        // Spinning for the 99th percentile lateness keeps the hybrid wait on time nearly always.
+        std::sort(latenessNs.begin(), latenessNs.end());
+        const auto measured = static_cast<uint64_t>(std::max<int64_t>(1, latenessNs[TRIALS * 99 / 100]));
+        uint64_t expected = 0;
+        sleepWakeupLatencyNs.compare_exchange_strong(expected, measured, std::memory_order_acq_rel);
+        return expected == 0 ? measured : expected;
     }
 
-    void Stopwatch::reset() {
-        elapsedTsc = 0;
+    template<typename ClockPolicy, typename... FencePolicies>
+    static void measureEachFence(TimerFactory &factory, std::vector<StopwatchOverhead> &overheads) {
+        (overheads.push_back(factory.measureStopwatchOverhead<ClockPolicy, FencePolicies>()), ...);
     }
 
-    uint64_t Stopwatch::getElapsedNanoseconds() const {
-        return (elapsedTsc * nanosecondPerTsc_shr16) >> 16;
+    std::vector<StopwatchOverhead> TimerFactory::measureStopwatchOverheads() {
+        std::vector<StopwatchOverhead> overheads;
+        measureEachFence<RdtscClock, NoFence, LoadFence, MemoryFence, SerializingFence>(*this, overheads);
+        measureEachFence<RdtscpClock, NoFence, LoadFence, MemoryFence, SerializingFence>(*this, overheads);
+        measureEachFence<MonotonicRawClock, NoFence, LoadFence, MemoryFence, SerializingFence>(*this, overheads);
+        return overheads;
     }
 }
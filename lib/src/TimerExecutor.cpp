@@ -0,0 +1,155 @@
+#include "TimerExecutor.h"
+#include "timetools.h"
+#include "Utility.h"
+#include <bit>
+#include <future>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+namespace timetools {
+    thread_local const TimerExecutor *TimerExecutor::runningExecutor = nullptr;
+
+    TimerExecutor::TimerExecutor(TimerFactory &factory, const TimerExecutorOptions &options)
+        : options(options),
+          queue(std::make_unique<Submission[]>(options.queueCapacity)),
+          queueMask(options.queueCapacity - 1),
+          arena(std::make_unique<TimerNode[]>(options.maxTimers)),
+          wheels(std::make_unique<TimerNode *[]>(LEVEL_COUNT * SLOTS_PER_LEVEL)) {
+        if (!std::has_single_bit(options.queueCapacity))
+            throw std::invalid_argument("The timer queue's capacity must be a power of two");
+        for (size_t i = 0; i < options.queueCapacity; ++i)
+            queue[i].sequence.store(i, std::memory_order_relaxed);
+        for (size_t i = 0; i < options.maxTimers; ++i) {
+            arena[i].next = freeNodes;
+            freeNodes = &arena[i];
+        }
+
+        // Deadlines are converted on the scheduling threads, so use a rate that every core agrees on.
+        factory.calibrateAllCores();
+        conversion = options.cpu >= 0 ? factory.createTscConversion(options.cpu) : factory.createTscConversion();
+
+        std::promise<int> started;
+        auto startError = started.get_future();
+        thread = std::thread([this, &started]() {
+            int error = 0;
+            if (this->options.cpu >= 0)
+                error = setThisThreadAffinity(this->options.cpu);
+            if (error == 0 && this->options.realtimePriority > 0)
+                error = setThisThreadFifoRealtimePriority(this->options.realtimePriority);
+            started.set_value(error);
+            if (error == 0)
+                run();
+        });
+        if (const auto error = startError.get(); error != 0) {
+            thread.join();
+            throw std::system_error(error, std::generic_category(), "Couldn't set up the timer executor thread");
+        }
+    }
+
+    TimerExecutor::~TimerExecutor() {
+        stopping.store(true, std::memory_order_relaxed);
+        thread.join();
+    }
+
+    void TimerExecutor::run() {
+        runningExecutor = this;
+        currentSlot = __rdtsc() >> options.slotTscShift;
+        while (!stopping.load(std::memory_order_relaxed)) {
+            drainSubmissions();
+            advance(__rdtsc());
+            _mm_pause();
+        }
+    }
+
+    void TimerExecutor::drainSubmissions() {
+        // When the arena is used up, leave submissions in the queue until timers fire and free their nodes.
+        while (freeNodes != nullptr) {
+            auto &cell = queue[dequeuePosition & queueMask];
+            if (cell.sequence.load(std::memory_order_acquire) != dequeuePosition + 1)
+                return;
+            auto *node = freeNodes;
+            freeNodes = node->next;
+            node->deadlineTsc = cell.deadlineTsc;
+            node->callback = cell.callback;
+            node->context = cell.context;
+            cell.sequence.store(dequeuePosition + queueMask + 1, std::memory_order_release);
+            ++dequeuePosition;
+            ++pendingCount;
+            insert(node);
+        }
+    }
+
+    bool TimerExecutor::scheduleDirectly(const uint64_t deadlineTsc, const TimerCallback callback, void *context) {
+        if (freeNodes == nullptr)
+            return false;
+        auto *node = freeNodes;
+        freeNodes = node->next;
+        node->deadlineTsc = deadlineTsc;
+        node->callback = callback;
+        node->context = context;
+        ++pendingCount;
+        insert(node);
+        return true;
+    }
+
+    void TimerExecutor::insert(TimerNode *node) {
+        // Timers that are already due go in the current slot, which is checked straight away.
+        const auto slot = std::max(node->deadlineTsc >> options.slotTscShift, currentSlot);
+        const auto differingBits = std::bit_width(slot ^ currentSlot);
+        auto level = differingBits == 0 ? 0 : static_cast<unsigned int>(differingBits - 1) / LEVEL_BITS;
+        auto *list = &getSlot(level, slot);
+        if (level >= LEVEL_COUNT) {
+            // Beyond the outermost wheel. Park it in the outermost slot that cascades last, and it will
+            // be filed again from there.
+            level = LEVEL_COUNT - 1;
+            list = &getSlot(level, currentSlot - (1ull << (level * LEVEL_BITS)));
+        }
+        node->next = *list;
+        *list = node;
+    }
+
+    void TimerExecutor::advance(const uint64_t nowTsc) {
+        const auto nowSlot = nowTsc >> options.slotTscShift;
+        while (currentSlot < nowSlot) {
+            if (pendingCount == 0) {
+                // Nothing is filed anywhere, so we can skip straight to now.
+                currentSlot = nowSlot;
+                break;
+            }
+            fireDue(UINT64_MAX);
+            ++currentSlot;
+            // Entering a new span of an outer wheel, so spread that span's timers over the inner wheels,
+            // outermost first.
+            unsigned int level = 0;
+            while (level + 1 < LEVEL_COUNT && (currentSlot & ((1ull << ((level + 1) * LEVEL_BITS)) - 1)) == 0)
+                ++level;
+            for (; level > 0; --level) {
+                auto *node = std::exchange(getSlot(level, currentSlot), nullptr);
+                while (node != nullptr) {
+                    auto *next = node->next;
+                    insert(node);
+                    node = next;
+                }
+            }
+        }
+        fireDue(nowTsc);
+    }
+
+    void TimerExecutor::fireDue(const uint64_t nowTsc) {
+        auto **link = &getSlot(0, currentSlot);
+        while (*link != nullptr) {
+            auto *node = *link;
+            if (node->deadlineTsc > nowTsc) {
+                link = &node->next;
+                continue;
+            }
+            *link = node->next;
+            node->callback(node->context);
+            node->next = freeNodes;
+            freeNodes = node;
+            --pendingCount;
+            firedCount.fetch_add(1, std::memory_order_release);
+        }
+    }
+}
@@ -0,0 +1,189 @@
+#include "Topology.h"
+#include "Utility.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <tuple>
+
+namespace timetools {
+    static std::string readLine(const std::string &path) {
+        std::ifstream file(path);
+        std::string line;
+        std::getline(file, line);
+        return line;
+    }
+
+    static int readInt(const std::string &path, const int fallback) {
+        try {
+            return std::stoi(readLine(path));
+        } catch (const std::exception &) {
+            return fallback;
+        }
+    }
+
+    const CpuDescription *CpuTopology::find(const int cpu) const {
+        const auto found = std::find_if(cpus.begin(), cpus.end(),
+                                        [cpu](const CpuDescription &description) { return description.cpu == cpu; });
+        return found == cpus.end() ? nullptr : &*found;
+    }
+
+    CpuTopology detail::readCpuTopology(const std::string &cpuDirectory, const std::vector<int> &cpus) {
+        const auto isolated = parseCpuList(readLine(cpuDirectory + "/isolated"));
+        const auto nohzFull = parseCpuList(readLine(cpuDirectory + "/nohz_full"));
+        CpuTopology topology;
+        for (const auto cpu: cpus) {
+            const auto directory = cpuDirectory + "/cpu" + std::to_string(cpu);
+            CpuDescription description;
+            description.cpu = cpu;
+            description.package = readInt(directory + "/topology/physical_package_id", 0);
+            description.smtSiblings = parseCpuList(readLine(directory + "/topology/thread_siblings_list"));
+            if (description.smtSiblings.empty())
+                description.smtSiblings.push_back(cpu);
+            description.core = description.smtSiblings.front();
+            // The cpu's directory links to its NUMA node's, as nodeN.
+            description.numaNode = -1;
+            std::error_code error;
+            for (const auto &entry: std::filesystem::directory_iterator(directory, error)) {
+                const auto name = entry.path().filename().string();
+                if (name.size() > 4 && name.compare(0, 4, "node") == 0) {
+                    try {
+                        description.numaNode = std::stoi(name.substr(4));
+                    } catch (const std::exception &) {
+                    }
+                }
+            }
+            // The last-level cache is the highest-level unified one, usually L3.
+            int highestLevel = 0;
+            description.cacheDomain = -1;
+            for (int index = 0;; ++index) {
+                const auto cache = directory + "/cache/index" + std::to_string(index);
+                const auto level = readInt(cache + "/level", -1);
+                if (level < 0)
+                    break;
+                if (level <= highestLevel || readLine(cache + "/type") == "Instruction")
+                    continue;
+                const auto shared = parseCpuList(readLine(cache + "/shared_cpu_list"));
+                if (!shared.empty()) {
+                    highestLevel = level;
+                    description.cacheDomain = shared.front();
+                }
+            }
+            if (description.cacheDomain < 0) {
+                const auto package = parseCpuList(readLine(directory + "/topology/core_siblings_list"));
+                description.cacheDomain = package.empty() ? description.core : package.front();
+            }
+            description.isolated = std::find(isolated.begin(), isolated.end(), cpu) != isolated.end();
+            description.nohzFull = std::find(nohzFull.begin(), nohzFull.end(), cpu) != nohzFull.end();
+            topology.cpus.push_back(description);
+        }
+        return topology;
+    }
+
+    CpuTopology getCpuTopology() {
+        return detail::readCpuTopology("/sys/devices/system/cpu", detail::getOnlineCpus());
+    }
+
+    std::vector<ThreadPlacement> planThreadPlacement(const CpuTopology &topology,
+                                                     const std::vector<ThreadRequest> &threads) {
+        const auto &cpus = topology.cpus;
+        // The role of the thread placed on each cpu, if any.
+        std::vector<const ThreadRole *> occupants(cpus.size(), nullptr);
+        const auto indexOf = [&](const int cpu) {
+            for (size_t i = 0; i < cpus.size(); ++i) {
+                if (cpus[i].cpu == cpu)
+                    return static_cast<ptrdiff_t>(i);
+            }
+            return static_cast<ptrdiff_t>(-1);
+        };
+        // Counts the sibling cpus (not including this one) that are occupied, and whether any of them spins or
+        // runs a hot worker.
+        struct Neighbours {
+            int occupied = 0;
+            bool spinning = false;
+            bool hot = false;
+        };
+        const auto getNeighbours = [&](const CpuDescription &description) {
+            Neighbours neighbours;
+            for (const auto sibling: description.smtSiblings) {
+                const auto index = indexOf(sibling);
+                if (sibling == description.cpu || index < 0 || occupants[index] == nullptr)
+                    continue;
+                ++neighbours.occupied;
+                neighbours.spinning |= *occupants[index] == ThreadRole::Spinning
+                        || *occupants[index] == ThreadRole::Pacer;
+                neighbours.hot |= *occupants[index] == ThreadRole::HotWorker;
+            }
+            return neighbours;
+        };
+        const auto countFreeCores = [&](const int cacheDomain) {
+            int freeCores = 0;
+            for (size_t i = 0; i < cpus.size(); ++i) {
+                if (cpus[i].cacheDomain == cacheDomain && cpus[i].core == cpus[i].cpu && occupants[i] == nullptr
+                    && getNeighbours(cpus[i]).occupied == 0)
+                    ++freeCores;
+            }
+            return freeCores;
+        };
+        const auto *cpuZero = topology.find(0);
+        const auto housekeepingCore = cpuZero != nullptr ? cpuZero->core : -1;
+
+        // Place the roles that need whole cores first, so that the others can't fragment them.
+        std::vector<size_t> order(threads.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](const size_t left, const size_t right) {
+            return threads[left].role < threads[right].role;
+        });
+
+        std::vector<ThreadPlacement> placements(threads.size(), {-1, false});
+        std::map<int, int> groupCacheDomains;
+        for (const auto threadIndex: order) {
+            const auto &thread = threads[threadIndex];
+            const auto spins = thread.role == ThreadRole::Spinning || thread.role == ThreadRole::Pacer;
+            const auto background = thread.role == ThreadRole::Background;
+            const auto group = groupCacheDomains.find(thread.group);
+            const auto hasGroupDomain = thread.group >= 0 && group != groupCacheDomains.end();
+
+            ptrdiff_t best = -1;
+            std::tuple<bool, bool, bool, bool, bool, int> bestScore;
+            for (size_t i = 0; i < cpus.size(); ++i) {
+                const auto &cpu = cpus[i];
+                if (occupants[i] != nullptr)
+                    continue;
+                const auto neighbours = getNeighbours(cpu);
+                if (neighbours.spinning || (spins && neighbours.occupied != 0))
+                    continue;
+                // Compared in order: the group's cache, isolation that suits the role, keeping background work off
+                // hot workers' cores, a core of its own unless it's background work, which packs onto cores other
+                // background work already uses, staying off the housekeeping core, then room for the rest of
+                // the group.
+                const std::tuple score{
+                    !hasGroupDomain || group->second == cpu.cacheDomain,
+                    background ? !cpu.isolated : cpu.isolated || cpu.nohzFull,
+                    !background || !neighbours.hot,
+                    background ? neighbours.occupied != 0 : neighbours.occupied == 0,
+                    background || cpu.core != housekeepingCore,
+                    hasGroupDomain || thread.group < 0 ? 0 : countFreeCores(cpu.cacheDomain)
+                };
+                if (best < 0 || score > bestScore) {
+                    best = static_cast<ptrdiff_t>(i);
+                    bestScore = score;
+                }
+            }
+            if (best < 0)
+                continue;
+            occupants[best] = &thread.role;
+            placements[threadIndex].cpu = cpus[best].cpu;
+            if (thread.group >= 0 && !hasGroupDomain)
+                groupCacheDomains[thread.group] = cpus[best].cacheDomain;
+        }
+
+        for (size_t i = 0; i < threads.size(); ++i) {
+            const auto index = indexOf(placements[i].cpu);
+            if (index >= 0)
+                placements[i].sharesCore = getNeighbours(cpus[index]).occupied != 0;
+        }
+        return placements;
+    }
+}
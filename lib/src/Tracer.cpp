@@ -0,0 +1,343 @@
+#include "Tracer.h"
+#include "timetools.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace timetools::detail {
+    // A trace file is this header, the records in the order they were drained, then a footer holding
+    // the number of cores, each core's TSC frequency in Hz, the number of events, and each event's name.
+    struct TraceFileHeader {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t recordSize;
+        uint64_t recordCount;
+        uint64_t footerOffset;
+        uint32_t processId;
+        uint8_t reserved[28];
+    };
+
+    static_assert(sizeof(TraceFileHeader) == 64);
+
+    static constexpr uint64_t TRACE_MAGIC = 0x3145434152545454; // "TTTRACE1"
+    static constexpr uint32_t TRACE_VERSION = 1;
+
+    static void writeJsonString(std::ostream &out, const std::string &text) {
+        out << '"';
+        for (const auto c: text) {
+            if (c == '"' || c == '\\') {
+                out << '\\' << c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                constexpr char HEX[] = "0123456789abcdef";
+                out << "\\u00" << HEX[c >> 4] << HEX[c & 0xf];
+            } else {
+                out << c;
+            }
+        }
+        out << '"';
+    }
+}
+
+namespace timetools {
+    Tracer::Tracer(TimerFactory &factory, const std::string &path, const TracerOptions &options)
+        : factory(factory), options(options),
+          buffers(std::make_unique<std::atomic<ThreadBuffer *>[]>(MAX_THREADS)) {
+        fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "Couldn't create trace file " + path);
+        if (!reserveFileSpace(options.fileGrowthRecords)) {
+            const auto error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "Couldn't map trace file " + path);
+        }
+        // The converter needs a rate for every core a record might come from.
+        factory.calibrateAllCores();
+        drainer = std::thread(&Tracer::drainLoop, this);
+    }
+
+    Tracer::~Tracer() {
+        close();
+        for (unsigned int i = 0; i < MAX_THREADS; ++i) {
+            if (auto *buffer = buffers[i].load(); buffer != nullptr) {
+                munmap(buffer->records, (buffer->mask + 1) * sizeof(TraceRecord));
+                delete buffer;
+            }
+        }
+    }
+
+    uint32_t Tracer::queryThreadId() {
+        return static_cast<uint32_t>(syscall(SYS_gettid));
+    }
+
+    Tracer::ThreadBuffer &Tracer::createBuffer(const unsigned int index) {
+        const auto bytes = options.recordsPerThread * sizeof(TraceRecord);
+        // Populate the pages now so that recording never takes a page fault.
+        void *records = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (records == MAP_FAILED)
+            throw std::system_error(errno, std::generic_category(), "Couldn't allocate trace buffer");
+        auto *created = new ThreadBuffer;
+        created->records = static_cast<TraceRecord *>(records);
+        created->mask = options.recordsPerThread - 1;
+        ThreadBuffer *existing = nullptr;
+        if (buffers[index].compare_exchange_strong(existing, created, std::memory_order_acq_rel))
+            return *created;
+        munmap(records, bytes);
+        delete created;
+        return *existing;
+    }
+
+    bool Tracer::reserveFileSpace(const uint64_t records) {
+        const auto needed = sizeof(detail::TraceFileHeader) + (writtenRecords + records) * sizeof(TraceRecord);
+        if (needed <= mappingSize)
+            return true;
+        const auto newSize = needed + options.fileGrowthRecords * sizeof(TraceRecord);
+        if (ftruncate(fd, static_cast<off_t>(newSize)) != 0)
+            return false;
+        void *address = mapping == nullptr
+                            ? mmap(nullptr, newSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                            : mremap(mapping, mappingSize, newSize, MREMAP_MAYMOVE);
+        if (address == MAP_FAILED)
+            return false;
+        mapping = static_cast<uint8_t *>(address);
+        mappingSize = newSize;
+        return true;
+    }
+
+    void Tracer::drain() {
+        for (unsigned int i = 0; i < MAX_THREADS; ++i) {
+            auto *buffer = buffers[i].load(std::memory_order_acquire);
+            if (buffer == nullptr)
+                continue;
+            const auto tail = buffer->tail.load(std::memory_order_relaxed);
+            const auto head = buffer->head.load(std::memory_order_acquire);
+            const auto count = head - tail;
+            if (count == 0 || !reserveFileSpace(count))
+                continue;
+            // The ring's contents are at most two contiguous runs.
+            auto *destination = reinterpret_cast<TraceRecord *>(mapping + sizeof(detail::TraceFileHeader))
+                                + writtenRecords;
+            const auto first = tail & buffer->mask;
+            const auto firstRun = std::min(count, buffer->mask + 1 - first);
+            std::memcpy(destination, buffer->records + first, firstRun * sizeof(TraceRecord));
+            std::memcpy(destination + firstRun, buffer->records, (count - firstRun) * sizeof(TraceRecord));
+            writtenRecords += count;
+            buffer->tail.store(head, std::memory_order_release);
+        }
+    }
+
+    void Tracer::drainLoop() {
+        const auto interval = std::chrono::nanoseconds(options.drainIntervalNanoseconds);
+        std::unique_lock lock(stopMutex);
+        while (!stopping) {
+            lock.unlock();
+            drain();
+            lock.lock();
+            stopCondition.wait_for(lock, interval, [this]() { return stopping; });
+        }
+    }
+
+    uint16_t Tracer::registerEvent(const std::string &name) {
+        std::lock_guard lock(eventNamesMutex);
+        const auto existing = std::find(eventNames.begin(), eventNames.end(), name);
+        if (existing != eventNames.end())
+            return static_cast<uint16_t>(existing - eventNames.begin());
+        if (eventNames.size() > UINT16_MAX)
+            throw std::length_error("Too many trace events");
+        eventNames.push_back(name);
+        return static_cast<uint16_t>(eventNames.size() - 1);
+    }
+
+    uint64_t Tracer::getDroppedCount() const {
+        uint64_t dropped = unbufferedDropped.load(std::memory_order_relaxed);
+        for (unsigned int i = 0; i < MAX_THREADS; ++i) {
+            if (const auto *buffer = buffers[i].load(std::memory_order_acquire); buffer != nullptr)
+                dropped += buffer->dropped.load(std::memory_order_relaxed);
+        }
+        return dropped;
+    }
+
+    void Tracer::close() {
+        if (closed)
+            return;
+        closed = true;
+        {
+            std::lock_guard lock(stopMutex);
+            stopping = true;
+        }
+        stopCondition.notify_one();
+        drainer.join();
+        drain();
+
+        std::vector<uint8_t> footer;
+        const auto append = [&footer](const void *data, const size_t size) {
+            const auto *bytes = static_cast<const uint8_t *>(data);
+            footer.insert(footer.end(), bytes, bytes + size);
+        };
+        const uint32_t coreCount = factory.getCoreCount();
+        append(&coreCount, sizeof(coreCount));
+        for (unsigned int core = 0; core < coreCount; ++core) {
+            const uint64_t frequencyHz = factory.getTscFrequencyHz(core);
+            append(&frequencyHz, sizeof(frequencyHz));
+        }
+        {
+            std::lock_guard lock(eventNamesMutex);
+            const uint32_t eventCount = eventNames.size();
+            append(&eventCount, sizeof(eventCount));
+            for (const auto &name: eventNames) {
+                const uint16_t length = std::min<size_t>(name.size(), UINT16_MAX);
+                append(&length, sizeof(length));
+                append(name.data(), length);
+            }
+        }
+
+        detail::TraceFileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        header.magic = detail::TRACE_MAGIC;
+        header.version = detail::TRACE_VERSION;
+        header.recordSize = sizeof(TraceRecord);
+        header.recordCount = writtenRecords;
+        header.footerOffset = sizeof(header) + writtenRecords * sizeof(TraceRecord);
+        header.processId = static_cast<uint32_t>(getpid());
+
+        munmap(mapping, mappingSize);
+        mapping = nullptr;
+        mappingSize = 0;
+        if (ftruncate(fd, static_cast<off_t>(header.footerOffset)) == 0) {
+            (void) pwrite(fd, footer.data(), footer.size(), static_cast<off_t>(header.footerOffset));
+            (void) pwrite(fd, &header, sizeof(header), 0);
+        }
+        ::close(fd);
+        fd = -1;
+    }
+
+    int convertTraceToChromeJson(const std::string &tracePath, std::ostream &out) {
+        const int fd = open(tracePath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return errno;
+        struct stat status;
+        if (fstat(fd, &status) != 0) {
+            const auto error = errno;
+            close(fd);
+            return error;
+        }
+        const auto size = static_cast<size_t>(status.st_size);
+        if (size < sizeof(detail::TraceFileHeader)) {
+            close(fd);
+            return EINVAL;
+        }
+        void *address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (address == MAP_FAILED)
+            return errno;
+        const auto *bytes = static_cast<const uint8_t *>(address);
+        const auto unmap = [address, size]() { munmap(address, size); };
+
+        detail::TraceFileHeader header;
+        std::memcpy(&header, bytes, sizeof(header));
+        if (header.magic != detail::TRACE_MAGIC || header.version != detail::TRACE_VERSION
+            || header.recordSize != sizeof(TraceRecord)
+            || header.footerOffset != sizeof(header) + header.recordCount * sizeof(TraceRecord)
+            || header.footerOffset + sizeof(uint32_t) > size) {
+            unmap();
+            return EINVAL;
+        }
+
+        // Parse the footer.
+        const auto *cursor = bytes + header.footerOffset;
+        const auto *end = bytes + size;
+        const auto take = [&cursor, end](void *data, const size_t length) {
+            if (static_cast<size_t>(end - cursor) < length)
+                return false;
+            std::memcpy(data, cursor, length);
+            cursor += length;
+            return true;
+        };
+        uint32_t coreCount;
+        // Check the count against what's left before allocating for it, since the file may be corrupt.
+        if (!take(&coreCount, sizeof(coreCount))
+            || static_cast<size_t>(end - cursor) / sizeof(uint64_t) < coreCount) {
+            unmap();
+            return EINVAL;
+        }
+        std::vector<uint64_t> frequencies(coreCount);
+        uint64_t anyFrequency = 0;
+        for (auto &frequency: frequencies) {
+            if (!take(&frequency, sizeof(frequency))) {
+                unmap();
+                return EINVAL;
+            }
+            if (anyFrequency == 0)
+                anyFrequency = frequency;
+        }
+        uint32_t eventCount = 0;
+        if (!take(&eventCount, sizeof(eventCount)) || anyFrequency == 0) {
+            unmap();
+            return EINVAL;
+        }
+        std::vector<std::string> eventNames(eventCount);
+        for (auto &name: eventNames) {
+            uint16_t length;
+            if (!take(&length, sizeof(length)) || static_cast<size_t>(end - cursor) < length) {
+                unmap();
+                return EINVAL;
+            }
+            name.assign(reinterpret_cast<const char *>(cursor), length);
+            cursor += length;
+        }
+
+        const auto *records = reinterpret_cast<const TraceRecord *>(bytes + sizeof(header));
+        uint64_t firstTsc = UINT64_MAX;
+        for (uint64_t i = 0; i < header.recordCount; ++i)
+            firstTsc = std::min(firstTsc, records[i].tsc);
+
+        out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        for (uint64_t i = 0; i < header.recordCount; ++i) {
+            const auto &record = records[i];
+            const auto core = record.cpu & detail::TSC_AUX_CPU_MASK;
+            const auto frequency = core < coreCount && frequencies[core] != 0 ? frequencies[core] : anyFrequency;
+            const auto nanoseconds = static_cast<uint64_t>(
+                static_cast<unsigned __int128>(record.tsc - firstTsc) * 1000000000 / frequency);
+
+            out << (i == 0 ? "\n" : ",\n") << "{\"name\":";
+            if (record.eventId < eventNames.size())
+                detail::writeJsonString(out, eventNames[record.eventId]);
+            else
+                out << "\"event " << record.eventId << '"';
+            out << ",\"ph\":\"";
+            switch (record.phase) {
+                case TracePhase::Begin:
+                    out << 'B';
+                    break;
+                case TracePhase::End:
+                    out << 'E';
+                    break;
+                case TracePhase::Instant:
+                    out << "i\",\"s\":\"t";
+                    break;
+                case TracePhase::Counter:
+                    out << 'C';
+                    break;
+            }
+            // Chrome wants microseconds; keep the nanoseconds as a fraction.
+            const auto fraction = nanoseconds % 1000;
+            out << "\",\"ts\":" << nanoseconds / 1000 << '.'
+                    << static_cast<char>('0' + fraction / 100)
+                    << static_cast<char>('0' + fraction / 10 % 10)
+                    << static_cast<char>('0' + fraction % 10)
+                    << ",\"pid\":" << header.processId << ",\"tid\":" << record.thread;
+            if (record.phase == TracePhase::Counter)
+                out << ",\"args\":{\"value\":" << record.payload << "}}";
+            else
+                out << ",\"args\":{\"cpu\":" << core << ",\"payload\":" << record.payload << "}}";
+        }
+        out << "\n]}\n";
+        unmap();
+        return out.good() ? 0 : EIO;
+    }
+}
@@ -0,0 +1,133 @@
+#include "TscConversion.h"
+#include <bit>
+#include <cassert>
+#include <immintrin.h>
+
+namespace timetools {
+    // Finds the multiplier in [2^63, 2^64) and the shift for which multiplier / 2^shift is closest to
+    // numerator / denominator.
+    static void makeFactor(const uint64_t numerator, const uint64_t denominator, uint64_t &multiplier,
+                           unsigned int &shift) {
+        assert(numerator != 0 && denominator != 0);
+        // Puts the quotient in (2^62, 2^64).
+        auto candidate = 63 + std::bit_width(denominator) - std::bit_width(numerator);
+        while (true) {
+            const auto scaled = static_cast<unsigned __int128>(numerator) << candidate;
+            const auto quotient = (scaled + denominator / 2) / denominator;
+            if (quotient >> 64 != 0) {
+                --candidate;
+            } else if (quotient >> 63 == 0) {
+                ++candidate;
+            } else {
+                multiplier = static_cast<uint64_t>(quotient);
+                shift = candidate;
+                return;
+            }
+        }
+    }
+
+    TscConversion::TscConversion(const uint64_t tscPerNanosecond_shl25) {
+        makeFactor(1ull << 25, tscPerNanosecond_shl25, nanosecondsMultiplier, nanosecondsShift);
+        makeFactor(tscPerNanosecond_shl25, 1ull << 25, ticksMultiplier, ticksShift);
+    }
+
+    TscConversion TscConversion::fromFrequencyHz(const uint64_t frequencyHz) {
+        TscConversion conversion;
+        makeFactor(1000000000, frequencyHz, conversion.nanosecondsMultiplier, conversion.nanosecondsShift);
+        makeFactor(frequencyHz, 1000000000, conversion.ticksMultiplier, conversion.ticksShift);
+        return conversion;
+    }
+
+    // There's no 64x64->128-bit vector multiply, so the vector versions build each product from four 32x32->64-bit
+    // ones. Register shift counts of 64 or more give zero, which lets one sequence handle shifts on either side
+    // of 64 without a branch.
+    struct VectorShifts {
+        // A product whose high half is nonzero after shifting right by low doesn't fit.
+        __m128i high, carry, low;
+
+        explicit VectorShifts(const unsigned int shift)
+            : high(_mm_cvtsi64_si128(shift >= 64 ? shift - 64 : 64)),
+              carry(_mm_cvtsi64_si128(shift >= 64 ? 64 : 64 - shift)),
+              low(_mm_cvtsi64_si128(shift >= 64 ? 64 : shift)) {
+        }
+    };
+
+    __attribute__((target("avx2")))
+    static size_t toNanosecondsAvx2(const uint64_t *ticks, uint64_t *nanoseconds, const size_t count,
+                                    const uint64_t multiplierValue, const unsigned int shift) {
+        const auto multiplier = _mm256_set1_epi64x(static_cast<int64_t>(multiplierValue));
+        const auto multiplierHigh = _mm256_srli_epi64(multiplier, 32);
+        const auto low32 = _mm256_set1_epi64x(0xffffffff);
+        const auto ones = _mm256_set1_epi64x(-1);
+        const VectorShifts shifts(shift);
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            const auto value = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ticks + i));
+            const auto valueHigh = _mm256_srli_epi64(value, 32);
+            const auto lowLow = _mm256_mul_epu32(value, multiplier);
+            const auto lowHigh = _mm256_mul_epu32(value, multiplierHigh);
+            const auto highLow = _mm256_mul_epu32(valueHigh, multiplier);
+            const auto highHigh = _mm256_mul_epu32(valueHigh, multiplierHigh);
+            const auto middle = _mm256_add_epi64(_mm256_add_epi64(_mm256_srli_epi64(lowLow, 32),
+                                                                  _mm256_and_si256(lowHigh, low32)),
+                                                 _mm256_and_si256(highLow, low32));
+            const auto productLow = _mm256_or_si256(_mm256_slli_epi64(middle, 32), _mm256_and_si256(lowLow, low32));
+            const auto productHigh = _mm256_add_epi64(
+                _mm256_add_epi64(highHigh, _mm256_srli_epi64(middle, 32)),
+                _mm256_add_epi64(_mm256_srli_epi64(lowHigh, 32), _mm256_srli_epi64(highLow, 32)));
+            const auto result = _mm256_or_si256(_mm256_srl_epi64(productHigh, shifts.high),
+                                                _mm256_or_si256(_mm256_sll_epi64(productHigh, shifts.carry),
+                                                                _mm256_srl_epi64(productLow, shifts.low)));
+            const auto fits = _mm256_cmpeq_epi64(_mm256_srl_epi64(productHigh, shifts.low),
+                                                 _mm256_setzero_si256());
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(nanoseconds + i),
+                                _mm256_or_si256(result, _mm256_xor_si256(fits, ones)));
+        }
+        return i;
+    }
+
+    __attribute__((target("avx512f")))
+    static size_t toNanosecondsAvx512(const uint64_t *ticks, uint64_t *nanoseconds, const size_t count,
+                                      const uint64_t multiplierValue, const unsigned int shift) {
+        const auto multiplier = _mm512_set1_epi64(static_cast<int64_t>(multiplierValue));
+        const auto multiplierHigh = _mm512_srli_epi64(multiplier, 32);
+        const auto low32 = _mm512_set1_epi64(0xffffffff);
+        const auto ones = _mm512_set1_epi64(-1);
+        const VectorShifts shifts(shift);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            const auto value = _mm512_loadu_si512(ticks + i);
+            const auto valueHigh = _mm512_srli_epi64(value, 32);
+            const auto lowLow = _mm512_mul_epu32(value, multiplier);
+            const auto lowHigh = _mm512_mul_epu32(value, multiplierHigh);
+            const auto highLow = _mm512_mul_epu32(valueHigh, multiplier);
+            const auto highHigh = _mm512_mul_epu32(valueHigh, multiplierHigh);
+            const auto middle = _mm512_add_epi64(_mm512_add_epi64(_mm512_srli_epi64(lowLow, 32),
+                                                                  _mm512_and_si512(lowHigh, low32)),
+                                                 _mm512_and_si512(highLow, low32));
+            const auto productLow = _mm512_or_si512(_mm512_slli_epi64(middle, 32), _mm512_and_si512(lowLow, low32));
+            const auto productHigh = _mm512_add_epi64(
+                _mm512_add_epi64(highHigh, _mm512_srli_epi64(middle, 32)),
+                _mm512_add_epi64(_mm512_srli_epi64(lowHigh, 32), _mm512_srli_epi64(highLow, 32)));
+            const auto result = _mm512_or_si512(_mm512_srl_epi64(productHigh, shifts.high),
+                                                _mm512_or_si512(_mm512_sll_epi64(productHigh, shifts.carry),
+                                                                _mm512_srl_epi64(productLow, shifts.low)));
+            const auto fits = _mm512_cmpeq_epi64_mask(_mm512_srl_epi64(productHigh, shifts.low),
+                                                      _mm512_setzero_si512());
+            _mm512_storeu_si512(nanoseconds + i, _mm512_mask_mov_epi64(ones, fits, result));
+        }
+        return i;
+    }
+
+    void TscConversion::toNanoseconds(const uint64_t *ticks, uint64_t *nanoseconds, const size_t count) const {
+        static const bool hasAvx512 = __builtin_cpu_supports("avx512f");
+        static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+        size_t i = 0;
+        if (hasAvx512)
+            i = toNanosecondsAvx512(ticks, nanoseconds, count, nanosecondsMultiplier, nanosecondsShift);
+        else if (hasAvx2)
+            i = toNanosecondsAvx2(ticks, nanoseconds, count, nanosecondsMultiplier, nanosecondsShift);
+        for (; i < count; ++i)
+            nanoseconds[i] = toNanoseconds(ticks[i]);
+    }
+}
@@ -5,6 +5,7 @@
 #include <immintrin.h>
 #include <thread>
 #include <chrono>
+#include <cmath>
 #include <iostream>
 
 //extern bool hasGoodCpuTimer();
@@ -14,24 +15,54 @@ extern void busyWait(uint64_t nanosecondsToWait);
 }
 
 namespace timetools {
-    static bool hasTpause() {
-        int32_t eax, ebx, ecx, edx;
-        __cpuid(7, eax, ebx, ecx, edx);
+    bool Waiter::hasTpause() {
+        uint32_t eax, ebx, ecx, edx;
+        if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+            return false;
         bool yes = ecx & (1 << 5);
         return yes;
     }
 
-    static bool hasGoodCpuTimer() {
-        uint32_t eax, ebx, ecx, edx;
-        if (!__get_cpuid(0x15, &eax, &ebx, &ecx, &edx)) {
-            return false;
+    Waiter::Waiter(const uint64_t tscPerNanosecond_shl25, const WaitStrategy strategy, const uint64_t hybridSpinNs)
+        : tscPerNanosecond_shl25(tscPerNanosecond_shl25), conversion(tscPerNanosecond_shl25), useTpause(hasTpause()),
+          hybridSpinNs(hybridSpinNs) {
+        //std::cout << "Waiter's TSCs per nanosecond: " << (tscPerNanosecond_shl25 >> 25) << "\n";
+        this->strategy = strategy;
+        if (strategy == WaitStrategy::Automatic)
+            this->strategy = useTpause ? WaitStrategy::Tpause : WaitStrategy::PauseLoop;
+        else if (strategy == WaitStrategy::Tpause && !useTpause)
+            this->strategy = WaitStrategy::PauseLoop;
+        switch (this->strategy) {
+            case WaitStrategy::UnrolledPauseLoop:
+                waitFunction = &Waiter::rdtscPauseUnrolledWait;
+                break;
+            case WaitStrategy::Rdtscp:
+                waitFunction = &Waiter::rdtscpWait;
+                break;
+            case WaitStrategy::Tpause:
+                waitFunction = &Waiter::tpauseLoopWait;
+                break;
+            case WaitStrategy::Nanosleep:
+                waitFunction = &Waiter::nanosleepWait;
+                break;
+            case WaitStrategy::SystemClockSpin:
+                waitFunction = &Waiter::systemClockBusyWait;
+                break;
+            case WaitStrategy::ThreadSleep:
+                waitFunction = &Waiter::threadSleep;
+                break;
+            case WaitStrategy::Hybrid:
+                waitFunction = &Waiter::hybridWait;
+                break;
+            default:
+                waitFunction = &Waiter::rdtscPauseLoopWait;
+                break;
         }
-        return eax != 0 && ebx != 0 && ecx != 0;
     }
 
     void Waiter::rdtscPauseLoopWait(const uint64_t nanosecondsToWait) const {
         const auto tsc_initial = __rdtsc();
-        const uint64_t tsc_to_wait = ((nanosecondsToWait * tscPerNanosecond_shl25) >> 25) - overheadTsc;
+        const uint64_t tsc_to_wait = getCorrectedWaitTsc(nanosecondsToWait);
         const auto tsc_final = tsc_initial + tsc_to_wait;
 
         while (tsc_final > __rdtsc()) {
@@ -41,7 +72,7 @@ namespace timetools {
 
     void Waiter::rdtscPauseUnrolledWait(const uint64_t nanosecondsToWait) const {
         const auto tsc_initial = __rdtsc();
-        const uint64_t tsc_to_wait = ((nanosecondsToWait * tscPerNanosecond_shl25) >> 25) - overheadTsc;
+        const uint64_t tsc_to_wait = getCorrectedWaitTsc(nanosecondsToWait);
         const auto tsc_final = tsc_initial + tsc_to_wait;
 
         while (true) {
@@ -63,7 +94,7 @@ namespace timetools {
     void Waiter::rdtscpWait(uint64_t nanosecondsToWait) const {
         unsigned int cpu_old;
         auto tsc_initial = __rdtscp(&cpu_old);
-        uint64_t tsc_to_wait = ((nanosecondsToWait * tscPerNanosecond_shl25) >> 25);
+        uint64_t tsc_to_wait = getCorrectedWaitTsc(nanosecondsToWait);
 
         while (true) {
             unsigned int cpu_new;
@@ -83,9 +114,9 @@ namespace timetools {
         }
     }
 
-    void Waiter::tpauseLoopWait(const uint64_t nanosecondsToWait) {
+    __attribute__((target("waitpkg"))) void Waiter::tpauseLoopWait(const uint64_t nanosecondsToWait) const {
         const auto tsc_initial = __rdtsc();
-        const uint64_t tsc_to_wait = ((nanosecondsToWait * tscPerNanosecond_shl25) >> 25) - overheadTsc;
+        const uint64_t tsc_to_wait = getCorrectedWaitTsc(nanosecondsToWait);
         const auto tsc_final = tsc_initial + tsc_to_wait;
 
         while (tsc_final > __rdtsc()) {
@@ -94,7 +125,7 @@ namespace timetools {
         }
     }
 
-    void Waiter::nanosleepWait(uint64_t nanosecondsToWait) {
+    void Waiter::nanosleepWait(uint64_t nanosecondsToWait) const {
         timespec stopTime;
         clock_gettime(CLOCK_MONOTONIC, &stopTime);
         constexpr long NANOSECONDS_PER_SECOND = 1000000000;
@@ -107,17 +138,128 @@ namespace timetools {
         clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &stopTime, nullptr);
     }
 
-    void Waiter::systemClockBusyWait(uint64_t nanosecondsToWait) {
+    void Waiter::systemClockBusyWait(uint64_t nanosecondsToWait) const {
         const auto stopTime = std::chrono::system_clock::now() + std::chrono::nanoseconds(nanosecondsToWait);
         while (std::chrono::system_clock::now() < stopTime);
     }
 
-    void Waiter::threadSleep(uint64_t nanosecondsToWait) {
+    void Waiter::threadSleep(uint64_t nanosecondsToWait) const {
         std::this_thread::sleep_for(std::chrono::nanoseconds(nanosecondsToWait));
     }
 
-    void Waiter::busyWait(const uint64_t nanosecondsToWait) {
-        rdtscPauseLoopWait(nanosecondsToWait);
-        //rdtscpWait(nanosecondsToWait);
+    __attribute__((target("waitpkg"))) static void tpauseUntil(const uint64_t deadlineTsc) {
+        while (deadlineTsc > __rdtsc()) {
+            _tpause(1, deadlineTsc);
+            _mm_lfence();
+        }
+    }
+
+    void Waiter::spinUntilTsc(const uint64_t deadlineTsc) const {
+        if (useTpause) {
+            tpauseUntil(deadlineTsc);
+            return;
+        }
+        while (deadlineTsc > __rdtsc()) {
+            __pause();
+        }
+    }
+
+    void Waiter::hybridWait(const uint64_t nanosecondsToWait) const {
+        const auto deadlineTsc = __rdtsc() + conversion.toTicks(nanosecondsToWait);
+        if (nanosecondsToWait > hybridSpinNs)
+            nanosleepWait(nanosecondsToWait - hybridSpinNs);
+        spinUntilTsc(deadlineTsc);
+    }
+
+    void Waiter::waitUntilTsc(const uint64_t deadlineTsc) const {
+        switch (strategy) {
+            case WaitStrategy::PauseLoop:
+            case WaitStrategy::UnrolledPauseLoop:
+            case WaitStrategy::Rdtscp:
+                while (deadlineTsc > __rdtsc()) {
+                    __pause();
+                }
+                return;
+            case WaitStrategy::Tpause:
+                tpauseUntil(deadlineTsc);
+                return;
+            default:
+                break;
+        }
+        // The other strategies wait for a number of nanoseconds, so convert what's left.
+        const auto now = __rdtsc();
+        if (deadlineTsc <= now)
+            return;
+        (this->*waitFunction)(conversion.toNanoseconds(deadlineTsc - now));
+    }
+
+    template<typename T>
+    __attribute__((target("waitpkg"))) static bool umwaitForChange(const volatile T *address, const T expected,
+                                                                   const uint64_t deadlineTsc) {
+        while (true) {
+            _umonitor(const_cast<T *>(address));
+            // Check after arming the monitor, so that a store just before it isn't missed.
+            if (*address != expected)
+                return true;
+            if (__rdtsc() >= deadlineTsc)
+                return false;
+            // Also returns early at the OS's limit on umwait time, or on an interrupt, so go around again.
+            _umwait(1, deadlineTsc);
+        }
+    }
+
+    template<typename T>
+    static bool pauseForChange(const volatile T *address, const T expected, const uint64_t deadlineTsc) {
+        while (*address == expected) {
+            if (__rdtsc() >= deadlineTsc)
+                return false;
+            __pause();
+        }
+        return true;
+    }
+
+    template<typename T>
+    static bool waitForChangeUntil(const volatile T *address, const T expected, const uint64_t deadlineTsc,
+                                   const bool useUmwait) {
+        if (*address != expected)
+            return true;
+        return useUmwait ? umwaitForChange(address, expected, deadlineTsc)
+                         : pauseForChange(address, expected, deadlineTsc);
+    }
+
+    static uint64_t getDeadlineTsc(const uint64_t timeoutTsc) {
+        const auto now = __rdtsc();
+        return timeoutTsc > UINT64_MAX - now ? UINT64_MAX : now + timeoutTsc;
+    }
+
+    bool Waiter::waitForChange(const volatile uint32_t *address, const uint32_t expected,
+                               const uint64_t timeoutNanoseconds) const {
+        return waitForChangeUntil(address, expected, getDeadlineTsc(conversion.toTicks(timeoutNanoseconds)),
+                                  useTpause);
+    }
+
+    bool Waiter::waitForChange(const volatile uint64_t *address, const uint64_t expected,
+                               const uint64_t timeoutNanoseconds) const {
+        return waitForChangeUntil(address, expected, getDeadlineTsc(conversion.toTicks(timeoutNanoseconds)),
+                                  useTpause);
+    }
+
+    Pacer::Pacer(const Waiter &waiter, const uint64_t tscPerNanosecond_shl25, const double periodTsc,
+                 const uint64_t eventsPerDeadline)
+        : waiter(waiter), conversion(tscPerNanosecond_shl25),
+          periodTsc(static_cast<uint64_t>(periodTsc)),
+          periodFraction_shl32(static_cast<uint32_t>((periodTsc - std::floor(periodTsc)) * 0x1p32)),
+          eventsPerDeadline(eventsPerDeadline) {
+        start();
+    }
+
+    void Pacer::start() {
+        deadlineTsc = __rdtsc();
+        deadlineFraction_shl32 = 0;
+        // The first batch goes out now.
+        eventsLeft = eventsPerDeadline;
+        deadlineCount = 1;
+        overrunCount = 0;
+        maximumLatenessTsc = 0;
     }
 }
@@ -1,5 +1,8 @@
 #include "timetools.h"
+#include "Utility.h"
+#include <fstream>
 #include <pthread.h>
+#include <unistd.h>
 
 namespace timetools {
     int setThisThreadAffinity(const int cpu) {
@@ -20,3 +23,53 @@ namespace timetools {
         return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
     }
 }
+
+namespace timetools::detail {
+    std::vector<int> parseCpuList(const std::string &list) {
+        std::vector<int> cpus;
+        size_t position = 0;
+        while (position < list.size()) {
+            auto end = list.find(',', position);
+            if (end == std::string::npos)
+                end = list.size();
+            const auto range = list.substr(position, end - position);
+            const auto dash = range.find('-');
+            try {
+                const auto first = std::stoi(range);
+                const auto last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+                for (int cpu = first; cpu <= last; ++cpu)
+                    cpus.push_back(cpu);
+            } catch (const std::exception &) {
+                // Blank or malformed entry, such as the trailing newline.
+            }
+            position = end + 1;
+        }
+        return cpus;
+    }
+
+    unsigned int getPossibleCpuCount() {
+        std::ifstream possible("/sys/devices/system/cpu/possible");
+        std::string list;
+        if (std::getline(possible, list)) {
+            const auto cpus = parseCpuList(list);
+            if (!cpus.empty())
+                return cpus.back() + 1;
+        }
+        return static_cast<unsigned int>(sysconf(_SC_NPROCESSORS_CONF));
+    }
+
+    std::vector<int> getOnlineCpus() {
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+            CPU_ZERO(&allowed);
+        std::ifstream online("/sys/devices/system/cpu/online");
+        std::string list;
+        std::getline(online, list);
+        std::vector<int> cpus;
+        for (const auto cpu: parseCpuList(list)) {
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+                cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+}
@@ -0,0 +1,180 @@
+// Preloaded into programs that can't be rebuilt, to serve their short sleeps by spinning:
+//   LD_PRELOAD=libtimetools-preload.so program
+// Sleeps shorter than TIMETOOLS_PRELOAD_THRESHOLD_NS (100 us by default) are waited for with a calibrated Waiter,
+// and longer ones are passed to the real function. With TIMETOOLS_PRELOAD_STATS set, the counters are printed to
+// stderr when the program exits; timetools_preload_get_stats() returns them at any time.
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../../lib/include/timetools.h"
+
+extern "C" {
+struct timetools_preload_stats {
+    uint64_t spunCalls;
+    uint64_t passedThroughCalls;
+    uint64_t spunNanoseconds;
+    // The host's measured sleep wakeup latency, less how late each spin finished, summed over the spun calls.
+    uint64_t savedNanoseconds;
+};
+
+__attribute__((visibility("default"))) void timetools_preload_get_stats(timetools_preload_stats *stats);
+}
+
+namespace {
+    using NanosleepFunction = int (*)(const timespec *, timespec *);
+    using UsleepFunction = int (*)(useconds_t);
+    using ClockNanosleepFunction = int (*)(clockid_t, int, const timespec *, timespec *);
+
+    NanosleepFunction realNanosleep;
+    UsleepFunction realUsleep;
+    ClockNanosleepFunction realClockNanosleep;
+
+    // Set up once at load and never destroyed, so that threads still sleeping during exit can use them.
+    timetools::TimerFactory *factory;
+    timetools::Waiter *waiter;
+    // A pointer rather than an object, since dynamic initialization of this file's globals runs after load().
+    const timetools::TscConversion *conversion;
+    uint64_t thresholdNanoseconds = 100000;
+    uint64_t sleepWakeupLatencyNs;
+    // Sleeps pass through uncounted until calibration is done, including the ones calibration makes itself.
+    std::atomic<bool> ready = false;
+    // A copy of stderr made at load, since some programs close theirs on the way out.
+    int statsFd = -1;
+
+    struct alignas(64) Counters {
+        std::atomic<uint64_t> spunCalls = 0;
+        std::atomic<uint64_t> passedThroughCalls = 0;
+        std::atomic<uint64_t> spunNanoseconds = 0;
+        std::atomic<uint64_t> savedNanoseconds = 0;
+    } counters;
+
+    uint64_t getEnvironmentValue(const char *name, const uint64_t fallback) {
+        const auto *value = std::getenv(name);
+        if (value == nullptr || *value == 0)
+            return fallback;
+        char *end;
+        const auto parsed = std::strtoull(value, &end, 10);
+        return *end == 0 ? parsed : fallback;
+    }
+
+    bool isValid(const timespec *time) {
+        return time != nullptr && time->tv_sec >= 0 && time->tv_nsec >= 0 && time->tv_nsec < 1000000000;
+    }
+
+    bool shouldSpin(const uint64_t nanoseconds) {
+        return nanoseconds < thresholdNanoseconds && ready.load(std::memory_order_acquire);
+    }
+
+    void spin(const uint64_t nanoseconds) {
+        const auto startTsc = __rdtsc();
+        const auto deadlineTsc = startTsc + conversion->toTicks(nanoseconds);
+        waiter->waitUntilTsc(deadlineTsc);
+        const auto endTsc = __rdtsc();
+        const auto latenessNanoseconds = conversion->toNanoseconds(endTsc > deadlineTsc ? endTsc - deadlineTsc : 0);
+        counters.spunCalls.fetch_add(1, std::memory_order_relaxed);
+        counters.spunNanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+        if (sleepWakeupLatencyNs > latenessNanoseconds) {
+            counters.savedNanoseconds.fetch_add(sleepWakeupLatencyNs - latenessNanoseconds,
+                                                std::memory_order_relaxed);
+        }
+    }
+
+    void passThrough() {
+        if (ready.load(std::memory_order_relaxed))
+            counters.passedThroughCalls.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Saturates rather than wrapping for times centuries away.
+    uint64_t toNanoseconds(const timespec &time) {
+        const auto seconds = static_cast<uint64_t>(time.tv_sec);
+        if (seconds >= UINT64_MAX / 1000000000 - 1)
+            return UINT64_MAX;
+        return seconds * 1000000000 + static_cast<uint64_t>(time.tv_nsec);
+    }
+
+    __attribute__((constructor)) void load() {
+        realNanosleep = reinterpret_cast<NanosleepFunction>(dlsym(RTLD_NEXT, "nanosleep"));
+        realUsleep = reinterpret_cast<UsleepFunction>(dlsym(RTLD_NEXT, "usleep"));
+        realClockNanosleep = reinterpret_cast<ClockNanosleepFunction>(dlsym(RTLD_NEXT, "clock_nanosleep"));
+        thresholdNanoseconds = getEnvironmentValue("TIMETOOLS_PRELOAD_THRESHOLD_NS", thresholdNanoseconds);
+        if (std::getenv("TIMETOOLS_PRELOAD_STATS") != nullptr)
+            statsFd = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+        try {
+            factory = new timetools::TimerFactory();
+            waiter = new timetools::Waiter(factory->createWaiter());
+            conversion = new timetools::TscConversion(factory->createTscConversion());
+            sleepWakeupLatencyNs = factory->getSleepWakeupLatencyNs();
+        } catch (const std::exception &e) {
+            // Leave every sleep to the real functions.
+            std::fprintf(stderr, "timetools-preload: couldn't calibrate, not spinning: %s\n", e.what());
+            return;
+        }
+        ready.store(true, std::memory_order_release);
+    }
+
+    __attribute__((destructor)) void unload() {
+        if (statsFd < 0)
+            return;
+        timetools_preload_stats stats;
+        timetools_preload_get_stats(&stats);
+        dprintf(statsFd,
+                "timetools-preload: %" PRIu64 " sleeps spun for %" PRIu64 " ns, saving about %" PRIu64
+                " ns; %" PRIu64 " passed through\n",
+                stats.spunCalls, stats.spunNanoseconds, stats.savedNanoseconds, stats.passedThroughCalls);
+    }
+}
+
+extern "C" {
+void timetools_preload_get_stats(timetools_preload_stats *stats) {
+    stats->spunCalls = counters.spunCalls.load(std::memory_order_relaxed);
+    stats->passedThroughCalls = counters.passedThroughCalls.load(std::memory_order_relaxed);
+    stats->spunNanoseconds = counters.spunNanoseconds.load(std::memory_order_relaxed);
+    stats->savedNanoseconds = counters.savedNanoseconds.load(std::memory_order_relaxed);
+}
+
+__attribute__((visibility("default"))) int nanosleep(const timespec *duration, timespec *remaining) {
+    if (isValid(duration) && shouldSpin(toNanoseconds(*duration))) {
+        spin(toNanoseconds(*duration));
+        return 0;
+    }
+    passThrough();
+    return realNanosleep(duration, remaining);
+}
+
+__attribute__((visibility("default"))) int usleep(const useconds_t microseconds) {
+    if (shouldSpin(static_cast<uint64_t>(microseconds) * 1000)) {
+        spin(static_cast<uint64_t>(microseconds) * 1000);
+        return 0;
+    }
+    passThrough();
+    return realUsleep(microseconds);
+}
+
+__attribute__((visibility("default"))) int clock_nanosleep(const clockid_t clock, const int flags,
+                                                           const timespec *time, timespec *remaining) {
+    // CPU-time clocks don't advance while this thread spins on behalf of another, so only wall clocks are served.
+    if ((clock == CLOCK_MONOTONIC || clock == CLOCK_REALTIME || clock == CLOCK_BOOTTIME) && isValid(time)
+        && ready.load(std::memory_order_acquire)) {
+        auto nanoseconds = toNanoseconds(*time);
+        if ((flags & TIMER_ABSTIME) != 0) {
+            timespec now;
+            clock_gettime(clock, &now);
+            const auto current = toNanoseconds(now);
+            nanoseconds = nanoseconds > current ? nanoseconds - current : 0;
+        }
+        if (shouldSpin(nanoseconds)) {
+            spin(nanoseconds);
+            return 0;
+        }
+    }
+    passThrough();
+    return realClockNanosleep(clock, flags, time, remaining);
+}
+}
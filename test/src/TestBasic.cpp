@@ -1,12 +1,17 @@
 #include <gtest/gtest.h>
 
 #include "../../lib/include/timetools.h"
+#include "../../lib/include/Topology.h"
+#include "../../lib/include/Utility.h"
 
 #include <chrono>
 #include <cstdint>
+#include <filesystem>
+#include <fstream>
 #include <sstream>
 #include <iomanip>
 #include <immintrin.h>
+#include <thread>
 
 class Stopwatch {
     std::chrono::time_point<std::chrono::high_resolution_clock> startTime;
@@ -28,6 +33,13 @@ public:
     }
 };
 
+// A core to itself, isolated if there are any, for the thread doing the timing.
+int getTimingCpu() {
+    static const int cpu = timetools::planThreadPlacement(timetools::getCpuTopology(),
+                                                          {{timetools::ThreadRole::Spinning}}).front().cpu;
+    return cpu;
+}
+
 void assertSuccess(const std::function<int()> &function) {
     const auto value = function();
     const auto error = errno;
@@ -36,7 +48,7 @@ void assertSuccess(const std::function<int()> &function) {
 }
 
 double getAverageErrorPercent(timetools::TimerFactory &factory, long waitNanoseconds, long trialCount) {
-    assertSuccess([]() { return timetools::setThisThreadAffinity(3); });
+    assertSuccess([]() { return timetools::setThisThreadAffinity(getTimingCpu()); });
     assertSuccess([]() { return timetools::setThisThreadFifoRealtimePriority(95); });
     auto waiter = factory.createWaiter();
     long totalAbsErrorNs = 0;
@@ -81,7 +93,7 @@ struct Results {
 Results characterizeWaiterAtFixedWait(timetools::TimerFactory &factory,
                                       const long waitNanoseconds,
                                       const long trialCount) {
-    assertSuccess([]() { return timetools::setThisThreadAffinity(3); });
+    assertSuccess([]() { return timetools::setThisThreadAffinity(getTimingCpu()); });
     assertSuccess([]() { return timetools::setThisThreadFifoRealtimePriority(95); });
     auto waiter = factory.createWaiter();
     long errors[trialCount];
@@ -119,7 +131,7 @@ std::vector<long> characterizeWaiterOverWaitRange(timetools::TimerFactory &facto
     if (stepNs < 1) {
         throw std::invalid_argument("Step size must be at least 1");
     }
-    assertSuccess([]() { return timetools::setThisThreadAffinity(3); });
+    assertSuccess([]() { return timetools::setThisThreadAffinity(getTimingCpu()); });
     assertSuccess([]() { return timetools::setThisThreadFifoRealtimePriority(95); });
     std::vector<long> results;
     results.reserve((maximumWaitNs - minimumWaitNs) / stepNs + 1);
@@ -138,9 +150,293 @@ std::vector<long> characterizeWaiterOverWaitRange(timetools::TimerFactory &facto
 }
 
 
+TEST(Basic, EstimateTscFrequency) {
+    const auto before = std::chrono::steady_clock::now();
+    const auto estimate = timetools::estimateTscFrequency();
+    const auto calibrationTime = std::chrono::steady_clock::now() - before;
+    EXPECT_LT(calibrationTime, std::chrono::milliseconds(500));
+    EXPECT_LT(estimate.uncertaintyPpm, 1000);
+
+    // Cross-check against the standard library's clock.
+    const auto tscBefore = __rdtsc();
+    const auto clockBefore = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    const auto tscAfter = __rdtsc();
+    const auto clockAfter = std::chrono::steady_clock::now();
+    const auto elapsedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(clockAfter - clockBefore).count();
+    const auto measuredHz = static_cast<double>(tscAfter - tscBefore) * 1e9 / static_cast<double>(elapsedNs);
+    EXPECT_NEAR(measuredHz, static_cast<double>(estimate.frequencyHz), measuredHz * 0.01);
+}
+
+TEST(Basic, CalibrationCache) {
+    const auto path = std::filesystem::temp_directory_path() / "timetools-test-calibration";
+    std::filesystem::remove(path);
+    {
+        timetools::detail::CalibrationCache cache(path);
+        EXPECT_EQ(0, cache.lookup(0));
+        cache.store(0, 1234567890);
+        EXPECT_EQ(1234567890, cache.lookup(0));
+    }
+    {
+        // Another process sees the stored value.
+        timetools::detail::CalibrationCache cache(path);
+        EXPECT_EQ(1234567890, cache.lookup(0));
+    }
+    {
+        timetools::detail::CalibrationCache mapped(path);
+        {
+            // Entries made on a different CPU are ignored. The key's CPU signature follows the magic, version and
+            // capacity.
+            std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+            file.seekp(16);
+            file.put('x');
+        }
+        timetools::detail::CalibrationCache cache(path);
+        EXPECT_EQ(0, cache.lookup(0));
+        EXPECT_EQ(0, mapped.lookup(0));
+        // Starting over rewrites the file in place, so a process that still has it mapped reads the new entries.
+        cache.store(0, 987654321);
+        EXPECT_EQ(987654321, cache.lookup(0));
+        EXPECT_EQ(987654321, mapped.lookup(0));
+    }
+    {
+        // Nor are entries anyone could have written.
+        std::filesystem::permissions(path, std::filesystem::perms::others_write, std::filesystem::perm_options::add);
+        timetools::detail::CalibrationCache cache(path);
+        EXPECT_EQ(0, cache.lookup(0));
+        std::filesystem::remove(path);
+    }
+    {
+        timetools::TimerFactoryOptions options;
+        options.calibrationCachePath = path;
+        timetools::TimerFactory factory(options);
+        (void) factory.createStopwatch();
+        unsigned int cpu;
+        __rdtscp(&cpu);
+        timetools::detail::CalibrationCache cache(path);
+        EXPECT_NE(0, cache.lookup(cpu));
+    }
+    std::filesystem::remove(path);
+}
+
+TEST(Basic, ParseCpuList) {
+    EXPECT_EQ(std::vector<int>({0, 1, 2, 3, 8, 10, 11}), timetools::detail::parseCpuList("0-3,8,10-11\n"));
+    EXPECT_EQ(std::vector<int>(), timetools::detail::parseCpuList(""));
+}
+
+TEST(Basic, TscOffsets) {
+    timetools::TimerFactoryOptions options;
+    options.measureTscOffsets = true;
+    timetools::TimerFactory factory(options);
+    const auto table = factory.getTscOffsets();
+    ASSERT_TRUE(table);
+    const auto cpus = timetools::detail::getOnlineCpus();
+    EXPECT_EQ(cpus.front(), table->referenceCore);
+    for (const auto cpu: cpus) {
+        EXPECT_NE(UINT64_MAX, table->uncertaintyTicks[cpu]) << cpu;
+        EXPECT_EQ(-table->getOffsetTicks(cpu, table->referenceCore), table->getOffsetTicks(table->referenceCore, cpu));
+    }
+    if (cpus.size() < 2)
+        GTEST_SKIP() << "Migration needs two cores";
+
+    // Migrate halfway through the interval.
+    std::thread([&factory, &cpus]() {
+        ASSERT_EQ(0, timetools::setThisThreadAffinity(cpus.front()));
+        auto stopwatch = factory.createStopwatch();
+        stopwatch.start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        ASSERT_EQ(0, timetools::setThisThreadAffinity(cpus.back()));
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        stopwatch.stop();
+        EXPECT_GE(stopwatch.getElapsedNanoseconds(), 10000000);
+        EXPECT_LT(stopwatch.getElapsedNanoseconds(), 100000000);
+    }).join();
+}
+
+TEST(Basic, ConcurrentCalibration) {
+    timetools::TimerFactoryOptions options;
+    options.calibrationCachePath = "";
+    options.eagerCalibration = true;
+    timetools::TimerFactory factory(options);
+    // Every core was calibrated up front, so creating timers is just a lookup wherever the threads run.
+    for (const auto cpu: timetools::detail::getOnlineCpus())
+        EXPECT_NE(0, factory.getTscFrequencyHz(cpu));
+    std::vector<std::thread> threads;
+    std::atomic<int> created = 0;
+    for (int i = 0; i < 16; ++i) {
+        threads.emplace_back([&factory, &created]() {
+            (void) factory.createWaiter();
+            (void) factory.createStopwatch();
+            ++created;
+        });
+    }
+    for (auto &thread: threads)
+        thread.join();
+    EXPECT_EQ(16, created);
+}
+
+template<typename ClockPolicy, typename FencePolicy>
+void expectStopwatchMeasuresSleep(timetools::TimerFactory &factory) {
+    auto stopwatch = factory.createStopwatch<ClockPolicy, FencePolicy>();
+    stopwatch.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    stopwatch.stop();
+    EXPECT_GE(stopwatch.getElapsedNanoseconds(), 10000000) << ClockPolicy::NAME << "+" << FencePolicy::NAME;
+    EXPECT_LT(stopwatch.getElapsedNanoseconds(), 100000000) << ClockPolicy::NAME << "+" << FencePolicy::NAME;
+}
+
+TEST(Basic, StopwatchPolicies) {
+    timetools::TimerFactory factory;
+    expectStopwatchMeasuresSleep<timetools::RdtscClock, timetools::NoFence>(factory);
+    expectStopwatchMeasuresSleep<timetools::RdtscClock, timetools::LoadFence>(factory);
+    expectStopwatchMeasuresSleep<timetools::RdtscpClock, timetools::MemoryFence>(factory);
+    expectStopwatchMeasuresSleep<timetools::RdtscpClock, timetools::SerializingFence>(factory);
+    expectStopwatchMeasuresSleep<timetools::MonotonicRawClock, timetools::NoFence>(factory);
+
+    std::cout << "Clock\tFence\tCost (ns)\tEmpty reading (ns)\n";
+    for (const auto &overhead: factory.measureStopwatchOverheads()) {
+        std::cout << overhead.clock << "\t" << overhead.fence << "\t"
+                << overhead.costNanoseconds << "\t" << overhead.emptyReadingNanoseconds << "\n";
+        EXPECT_LT(overhead.emptyReadingNanoseconds, 100000);
+    }
+}
+
+TEST(Basic, WaitStrategies) {
+    timetools::TimerFactory factory;
+    using timetools::WaitStrategy;
+    for (const auto strategy: {WaitStrategy::Automatic, WaitStrategy::PauseLoop, WaitStrategy::UnrolledPauseLoop,
+                               WaitStrategy::Rdtscp, WaitStrategy::Tpause, WaitStrategy::Nanosleep,
+                               WaitStrategy::SystemClockSpin, WaitStrategy::ThreadSleep, WaitStrategy::Hybrid}) {
+        auto waiter = factory.createWaiter(strategy);
+        EXPECT_NE(WaitStrategy::Automatic, waiter.getStrategy());
+        if (!timetools::Waiter::hasTpause())
+            EXPECT_NE(WaitStrategy::Tpause, waiter.getStrategy());
+        const auto before = std::chrono::steady_clock::now();
+        waiter.busyWait(200000);
+        const auto elapsed = std::chrono::steady_clock::now() - before;
+        EXPECT_GE(elapsed, std::chrono::microseconds(199)) << static_cast<int>(strategy);
+        EXPECT_LT(elapsed, std::chrono::milliseconds(50)) << static_cast<int>(strategy);
+    }
+}
+
+TEST(Basic, WaitForChange) {
+    timetools::TimerFactory factory;
+    for (const auto strategy: {timetools::WaitStrategy::Automatic, timetools::WaitStrategy::PauseLoop}) {
+        const auto waiter = factory.createWaiter(strategy);
+        alignas(64) volatile uint64_t value = 0;
+        std::thread writer([&value]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            value = 1;
+        });
+        const auto before = std::chrono::steady_clock::now();
+        EXPECT_TRUE(waiter.waitForChange(&value, 0, 10000000000));
+        const auto elapsed = std::chrono::steady_clock::now() - before;
+        writer.join();
+        EXPECT_EQ(1, value);
+        EXPECT_LT(elapsed, std::chrono::seconds(1));
+        // A value that already differs returns at once.
+        EXPECT_TRUE(waiter.waitForChange(&value, 0, 10000000000));
+
+        alignas(64) volatile uint32_t unchanged = 7;
+        const auto timeoutBefore = std::chrono::steady_clock::now();
+        EXPECT_FALSE(waiter.waitForChange(&unchanged, 7, 1000000));
+        EXPECT_GE(std::chrono::steady_clock::now() - timeoutBefore, std::chrono::microseconds(999));
+    }
+}
+
+TEST(Basic, HybridWaitSleepsMostOfTheTime) {
+    timetools::TimerFactory factory;
+    auto waiter = factory.createWaiter(timetools::WaitStrategy::Hybrid);
+    const auto spinNs = factory.getSleepWakeupLatencyNs();
+    constexpr uint64_t WAIT_NS = 20000000;
+    if (spinNs > WAIT_NS / 4)
+        GTEST_SKIP() << "This host wakes up too late (" << spinNs << "ns) to tell sleeping from spinning";
+
+    timespec cpuBefore, cpuAfter;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuBefore);
+    const auto before = std::chrono::steady_clock::now();
+    waiter.busyWait(WAIT_NS);
+    const auto elapsed = std::chrono::steady_clock::now() - before;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuAfter);
+    const auto cpuNs = (cpuAfter.tv_sec - cpuBefore.tv_sec) * 1000000000ll + cpuAfter.tv_nsec - cpuBefore.tv_nsec;
+    EXPECT_GE(elapsed, std::chrono::nanoseconds(WAIT_NS));
+    EXPECT_LT(cpuNs, WAIT_NS / 2);
+}
+
+TEST(Basic, OverheadCompensation) {
+    timetools::TimerFactory factory;
+    auto stopwatch = factory.createStopwatch();
+    std::vector<uint64_t> emptyReadings;
+    for (int trial = 0; trial < 101; ++trial) {
+        stopwatch.reset();
+        stopwatch.start();
+        stopwatch.stop();
+        emptyReadings.push_back(stopwatch.getElapsedNanoseconds());
+    }
+    std::sort(emptyReadings.begin(), emptyReadings.end());
+    EXPECT_LE(emptyReadings[50], 20);
+
+    auto waiter = factory.createWaiter(timetools::WaitStrategy::PauseLoop);
+    // Tiny waits used to underflow into near-infinite ones.
+    waiter.busyWait(0);
+    waiter.busyWait(1);
+
+    std::cout << "Intended wait (ns)\tMedian error (ns)\n";
+    for (long waitNs = 10; waitNs <= 1000000; waitNs *= 10) {
+        std::vector<int64_t> errorsNs;
+        for (int trial = 0; trial < 21; ++trial) {
+            stopwatch.reset();
+            stopwatch.start();
+            waiter.busyWait(waitNs);
+            stopwatch.stop();
+            errorsNs.push_back(static_cast<int64_t>(stopwatch.getElapsedNanoseconds()) - waitNs);
+        }
+        std::sort(errorsNs.begin(), errorsNs.end());
+        std::cout << waitNs << "\t" << errorsNs[10] << "\n";
+        EXPECT_LT(std::abs(errorsNs[10]), 100 + waitNs / 100);
+    }
+}
+
+TEST(Basic, PacerDoesNotDrift) {
+    // Pinned, so that the pacer's period is worked out from the rate of the core that's checked below.
+    assertSuccess([]() { return timetools::setThisThreadAffinity(getTimingCpu()); });
+    timetools::TimerFactory factory;
+    // 3 million events per second in batches of 8 makes a period that isn't a whole number of nanoseconds.
+    constexpr double EVENTS_PER_SECOND = 3000000;
+    constexpr int EVENTS = 300000;
+    auto pacer = factory.createPacer(EVENTS_PER_SECOND, 8);
+    const auto before = std::chrono::steady_clock::now();
+    pacer.start();
+    const auto firstDeadlineTsc = pacer.getNextDeadlineTsc();
+    for (int event = 0; event < EVENTS; ++event)
+        (void) pacer.pace();
+    const auto elapsed = std::chrono::steady_clock::now() - before;
+    const auto expected = std::chrono::nanoseconds(static_cast<long>(1e9 * (EVENTS - 8) / EVENTS_PER_SECOND));
+    EXPECT_EQ(EVENTS / 8, pacer.getDeadlineCount());
+    // The deadlines themselves stay a whole number of periods apart, to the tick.
+    const auto frequencyHz = factory.getTscFrequencyHz(getTimingCpu());
+    const auto periodTsc = 8 * static_cast<double>(frequencyHz) / EVENTS_PER_SECOND;
+    EXPECT_NEAR(EVENTS / 8 * periodTsc, static_cast<double>(pacer.getNextDeadlineTsc() - firstDeadlineTsc), 2);
+    // Waking up for the last deadline can be late if another thread has the cpu, but that mustn't add up.
+    EXPECT_GE(elapsed, expected);
+    EXPECT_LT(elapsed, expected * 1.01 + std::chrono::milliseconds(10));
+
+    // Falling behind is reported, and the missed deadlines are caught up on rather than skipped.
+    auto slowPacer = factory.createPacer(100000);
+    for (int event = 0; event < 10; ++event) {
+        (void) slowPacer.pace();
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    EXPECT_GT(slowPacer.getOverrunCount(), 0);
+    EXPECT_GE(slowPacer.getMaximumLatenessNanoseconds(), 50000);
+
+    EXPECT_THROW((void) factory.createPacer(0), std::invalid_argument);
+}
+
 TEST(Basic, TestBasic) {
     timetools::TimerFactory factory;
-    getAverageErrorPercent(factory, 1000, 1000);
+    // On a thread of its own, so that its realtime priority can't starve the threads later tests start.
+    std::thread([&factory]() { getAverageErrorPercent(factory, 1000, 1000); }).join();
 }
 
 TEST(Benchmark, TestWaitAccuracy) {
@@ -249,7 +545,7 @@ uint64_t timeFastLoop(timetools::TimerFactory &factory, long iterations) {
 }
 
 TEST(Benchmark, TimeLoop) {
-    assertSuccess([]() { return timetools::setThisThreadAffinity(3); });
+    assertSuccess([]() { return timetools::setThisThreadAffinity(getTimingCpu()); });
     assertSuccess([]() { return timetools::setThisThreadFifoRealtimePriority(95); });
     timetools::TimerFactory factory;
     std::cout << "Iterations\tTime (ns)\n";
@@ -294,7 +590,7 @@ uint64_t timeInlineDelay(timetools::TimerFactory &factory, long iterations) {
 }
 
 TEST(Benchmark, TimeInlineDelay) {
-    assertSuccess([]() { return timetools::setThisThreadAffinity(3); });
+    assertSuccess([]() { return timetools::setThisThreadAffinity(getTimingCpu()); });
     assertSuccess([]() { return timetools::setThisThreadFifoRealtimePriority(95); });
     timetools::TimerFactory factory;
     std::cout << "Iterations\tTime (ns)\n";
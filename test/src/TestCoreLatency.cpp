@@ -0,0 +1,39 @@
+#include <gtest/gtest.h>
+#include <sstream>
+
+#include "../../lib/include/CoreLatency.h"
+#include "../../lib/include/Utility.h"
+
+TEST(CoreLatency, MeasuresEachPairOnce) {
+    timetools::TimerFactory factory;
+    // Two threads on the same cpu still bounce the line, if slowly, so this works on a single-cpu host.
+    const auto cpu = timetools::detail::getOnlineCpus().front();
+    timetools::CoreLatencyOptions options;
+    options.cpus = {cpu, cpu, cpu};
+    options.roundTrips = 200;
+    options.warmupRoundTrips = 10;
+    const auto matrix = timetools::measureCoreLatency(factory, options);
+    ASSERT_EQ(3, matrix.cpus.size());
+    ASSERT_EQ(9, matrix.pairs.size());
+    for (size_t row = 0; row < 3; ++row) {
+        for (size_t column = 0; column < 3; ++column) {
+            const auto &pair = matrix.at(row, column);
+            EXPECT_EQ(0, pair.error);
+            EXPECT_EQ(row == column ? 0 : options.roundTrips, pair.roundTripNanoseconds.getCount());
+            EXPECT_EQ(pair.roundTripNanoseconds.getValueAtPercentile(50),
+                      matrix.at(column, row).roundTripNanoseconds.getValueAtPercentile(50));
+        }
+    }
+    EXPECT_GT(matrix.at(0, 1).roundTripNanoseconds.getMinimum(), 0);
+
+    std::ostringstream csv;
+    matrix.writeCsv(csv);
+    const auto c = std::to_string(cpu);
+    const auto p50 = std::to_string(matrix.at(0, 1).roundTripNanoseconds.getValueAtPercentile(50));
+    EXPECT_EQ(0, csv.str().find("cpu," + c + "," + c + "," + c + "\n" + c + ",," + p50 + ","));
+
+    std::ostringstream json;
+    matrix.writeJson(json);
+    EXPECT_EQ(0, json.str().find("{\n  \"cpus\": [" + c + ", " + c + ", " + c + "],\n  \"p50\": [\n    [null, " + p50));
+    EXPECT_NE(std::string::npos, json.str().find("\"max\""));
+}
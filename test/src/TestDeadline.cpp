@@ -0,0 +1,48 @@
+#include <gtest/gtest.h>
+#include <chrono>
+
+#include "../../lib/include/Deadline.h"
+
+TEST(Deadline, ExpiresAfterTheBudget) {
+    timetools::TimerFactory factory;
+    timetools::ShardedLatencyHistogram overshoots;
+    constexpr uint64_t BUDGET_NANOSECONDS = 2000000;
+    const auto before = std::chrono::steady_clock::now();
+    timetools::Deadline deadline(factory, BUDGET_NANOSECONDS, 1, &overshoots);
+    EXPECT_GT(deadline.getRemainingNanoseconds(), 0);
+    EXPECT_LE(deadline.getRemainingNanoseconds(), BUDGET_NANOSECONDS);
+    while (!deadline.expired()) {
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - before;
+    EXPECT_GE(elapsed, std::chrono::nanoseconds(BUDGET_NANOSECONDS) * 0.99);
+    EXPECT_EQ(0, deadline.getRemainingNanoseconds());
+    EXPECT_TRUE(deadline.expired());
+    EXPECT_EQ(1, overshoots.snapshot().getCount());
+    EXPECT_EQ(deadline.getOvershootNanoseconds(), overshoots.snapshot().getMaximum());
+
+    timetools::Deadline unlimited(factory, UINT64_MAX);
+    EXPECT_EQ(UINT64_MAX, unlimited.getDeadlineTsc());
+    EXPECT_FALSE(unlimited.expiredNow());
+}
+
+TEST(Deadline, PollsTheClockEveryIntervalAndChildrenNest) {
+    timetools::TimerFactory factory;
+    timetools::Deadline expired(factory, 0, 4);
+    // The first three polls don't read the TSC.
+    EXPECT_FALSE(expired.expired());
+    EXPECT_FALSE(expired.expired());
+    EXPECT_FALSE(expired.expired());
+    EXPECT_TRUE(expired.expired());
+    EXPECT_TRUE(expired.expired());
+
+    timetools::Deadline parent(factory, 1000000, 0);
+    EXPECT_EQ(1, parent.getPollInterval());
+    const auto longer = parent.createChild(1000000000, 16);
+    EXPECT_EQ(parent.getDeadlineTsc(), longer.getDeadlineTsc());
+    EXPECT_EQ(16, longer.getPollInterval());
+    auto shorter = parent.createChild(1000);
+    EXPECT_LT(shorter.getDeadlineTsc(), parent.getDeadlineTsc());
+    while (!shorter.expired()) {
+    }
+    EXPECT_FALSE(parent.expiredNow());
+}
@@ -0,0 +1,50 @@
+#include <gtest/gtest.h>
+
+#include "../../lib/include/timetools.h"
+
+#include <thread>
+
+static uint64_t clockGettimeNs(const clockid_t clock) {
+    timespec now;
+    clock_gettime(clock, &now);
+    return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+TEST(FastClock, AgreesWithClockGettime) {
+    timetools::TimerFactory factory;
+    timetools::FastClockOptions options;
+    options.refitIntervalNanoseconds = 10000000;
+    timetools::FastClock clock(factory, options);
+    for (int i = 0; i < 30; ++i) {
+        const auto monotonicBefore = clockGettimeNs(CLOCK_MONOTONIC);
+        const auto monotonic = clock.monotonicNow();
+        const auto monotonicAfter = clockGettimeNs(CLOCK_MONOTONIC);
+        EXPECT_GE(monotonic + 20000, monotonicBefore);
+        EXPECT_LE(monotonic, monotonicAfter + 20000);
+        const auto realtime = clock.now();
+        const auto realtimeAfter = clockGettimeNs(CLOCK_REALTIME);
+        EXPECT_NEAR(static_cast<double>(realtimeAfter), static_cast<double>(realtime), 20000);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_LT(std::abs(clock.getLastErrorNanoseconds()), 20000);
+}
+
+TEST(FastClock, NeverGoesBackwards) {
+    timetools::TimerFactory factory;
+    timetools::FastClockOptions options;
+    // Refit as often as possible to race the readers against the writer.
+    options.refitIntervalNanoseconds = 100000;
+    timetools::FastClock clock(factory, options);
+    uint64_t previous = clock.monotonicNow();
+    const auto before = __rdtsc();
+    constexpr int READS = 1000000;
+    for (int i = 0; i < READS; ++i) {
+        const auto current = clock.monotonicNow();
+        ASSERT_GE(current, previous);
+        previous = current;
+    }
+    const auto stopwatch = factory.createStopwatch();
+    std::cout << "FastClock::monotonicNow() costs about "
+              << stopwatch.toNanoseconds((__rdtsc() - before) / READS) << " ns\n";
+    EXPECT_EQ(0, clock.getStepCount());
+}
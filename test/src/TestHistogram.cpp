@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+
+#include "../../lib/include/timetools.h"
+
+#include <random>
+#include <thread>
+
+TEST(Histogram, BucketsCoverEveryValue) {
+    using timetools::LatencyHistogram;
+    for (size_t index = 0; index + 1 < LatencyHistogram::BUCKET_COUNT; ++index) {
+        // Buckets are contiguous...
+        ASSERT_EQ(LatencyHistogram::getBucketHighestValue(index) + 1, LatencyHistogram::getBucketLowestValue(index + 1));
+        // ...and no wider than 1/128 of their values.
+        const auto lowest = LatencyHistogram::getBucketLowestValue(index);
+        const auto width = LatencyHistogram::getBucketHighestValue(index) - lowest + 1;
+        ASSERT_LE(width, std::max<uint64_t>(1, lowest / LatencyHistogram::HALF_SUB_BUCKET_COUNT));
+    }
+    EXPECT_EQ(UINT64_MAX, LatencyHistogram::getBucketHighestValue(LatencyHistogram::BUCKET_COUNT - 1));
+    for (const uint64_t value: std::initializer_list<uint64_t>{0, 1, 255, 256, 257, 1000000, 123456789012, UINT64_MAX}) {
+        const auto index = LatencyHistogram::getBucketIndex(value);
+        EXPECT_LE(LatencyHistogram::getBucketLowestValue(index), value);
+        EXPECT_GE(LatencyHistogram::getBucketHighestValue(index), value);
+    }
+}
+
+TEST(Histogram, Percentiles) {
+    timetools::LatencyHistogram histogram;
+    EXPECT_EQ(0, histogram.getValueAtPercentile(50));
+    for (uint64_t value = 1; value <= 100000; ++value)
+        histogram.record(value);
+    EXPECT_EQ(100000, histogram.getCount());
+    EXPECT_EQ(1, histogram.getMinimum());
+    EXPECT_EQ(100000, histogram.getMaximum());
+    EXPECT_EQ(1, histogram.getValueAtPercentile(0));
+    EXPECT_EQ(100000, histogram.getValueAtPercentile(100));
+    EXPECT_NEAR(50000, histogram.getValueAtPercentile(50), 50000 / 128);
+    EXPECT_NEAR(99000, histogram.getValueAtPercentile(99), 99000 / 128);
+    EXPECT_NEAR(99900, histogram.getValueAtPercentile(99.9), 99900 / 128);
+    EXPECT_NEAR(50000.5, histogram.getMean(), 50000 / 128);
+}
+
+TEST(Histogram, MergeAndSerialize) {
+    std::mt19937_64 random(42);
+    std::lognormal_distribution<double> distribution(8, 1.5);
+    timetools::LatencyHistogram first, second;
+    for (int i = 0; i < 10000; ++i) {
+        first.record(static_cast<uint64_t>(distribution(random)));
+        second.record(static_cast<uint64_t>(distribution(random)));
+    }
+    auto merged = first;
+    merged.merge(second);
+    EXPECT_EQ(20000, merged.getCount());
+    EXPECT_EQ(std::min(first.getMinimum(), second.getMinimum()), merged.getMinimum());
+    EXPECT_EQ(std::max(first.getMaximum(), second.getMaximum()), merged.getMaximum());
+
+    const auto bytes = merged.serialize();
+    EXPECT_LT(bytes.size(), 8000u);
+    const auto restored = timetools::LatencyHistogram::deserialize(bytes.data(), bytes.size());
+    EXPECT_EQ(merged.getCount(), restored.getCount());
+    EXPECT_EQ(merged.getMinimum(), restored.getMinimum());
+    EXPECT_EQ(merged.getMaximum(), restored.getMaximum());
+    for (const double percentile: {1.0, 50.0, 99.0, 99.9})
+        EXPECT_EQ(merged.getValueAtPercentile(percentile), restored.getValueAtPercentile(percentile));
+
+    EXPECT_THROW(timetools::LatencyHistogram::deserialize(bytes.data(), bytes.size() / 2), std::invalid_argument);
+}
+
+TEST(Histogram, ShardedAcrossThreads) {
+    timetools::ShardedLatencyHistogram histogram;
+    constexpr int THREADS = 8;
+    constexpr int SAMPLES_PER_THREAD = 100000;
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < THREADS; ++thread) {
+        threads.emplace_back([&histogram, thread]() {
+            for (int i = 0; i < SAMPLES_PER_THREAD; ++i)
+                histogram.record(thread * 1000 + i % 1000);
+        });
+    }
+    for (auto &thread: threads)
+        thread.join();
+    const auto snapshot = histogram.snapshot();
+    EXPECT_EQ(THREADS * SAMPLES_PER_THREAD, snapshot.getCount());
+    EXPECT_EQ(0, snapshot.getMinimum());
+    EXPECT_EQ((THREADS - 1) * 1000 + 999, snapshot.getMaximum());
+}
+
+TEST(Histogram, FedFromStopwatch) {
+    timetools::TimerFactory factory;
+    // Sleeping may move us to another core, which the default rdtscp stopwatch asserts against.
+    auto stopwatch = factory.createStopwatch<timetools::RdtscClock, timetools::LoadFence>();
+    timetools::LatencyHistogram histogram;
+    for (int i = 0; i < 100; ++i) {
+        stopwatch.start();
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        stopwatch.stopAndRecord(histogram);
+    }
+    EXPECT_EQ(100, histogram.getCount());
+    EXPECT_GE(stopwatch.toNanoseconds(histogram.getValueAtPercentile(50)), 100000);
+    EXPECT_GE(stopwatch.getElapsedNanoseconds(), 100 * 100000);
+}
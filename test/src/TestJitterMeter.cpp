@@ -0,0 +1,42 @@
+#include <gtest/gtest.h>
+#include <sstream>
+
+#include "../../lib/include/JitterMeter.h"
+#include "../../lib/include/Utility.h"
+
+TEST(JitterMeter, AccountsForEveryGap) {
+    timetools::TimerFactory factory;
+    timetools::JitterOptions options;
+    options.cpus = {timetools::detail::getOnlineCpus().front()};
+    options.durationNanoseconds = 50000000;
+    // Normal priority, so that the scheduler tick and other processes do show up.
+    options.realtimePriority = 0;
+    options.maximumEventsPerCpu = 4;
+    const auto report = timetools::measureJitter(factory, options);
+    std::ostringstream printed;
+    report.print(printed);
+    std::cout << printed.str();
+
+    ASSERT_EQ(1, report.cpus.size());
+    const auto &cpu = report.cpus.front();
+    ASSERT_EQ(0, cpu.error);
+    EXPECT_NEAR(options.durationNanoseconds, cpu.durationNanoseconds, options.durationNanoseconds / 10);
+    EXPECT_LE(cpu.stolenNanoseconds, cpu.durationNanoseconds);
+    EXPECT_EQ(cpu.gaps.getCount(), cpu.events.size() + cpu.droppedEvents);
+    EXPECT_LE(cpu.events.size(), options.maximumEventsPerCpu);
+    // Gaps are compared with the threshold in ticks, so one just over it can round down to it in nanoseconds.
+    for (const auto &event: cpu.events)
+        EXPECT_GE(event.nanoseconds, options.thresholdNanoseconds);
+    EXPECT_EQ(std::vector<int>{cpu.cpu}, report.getQuietCpus(UINT64_MAX));
+    EXPECT_TRUE(cpu.gaps.getCount() == 0 || report.getQuietCpus(cpu.gaps.getMaximum() - 1).empty());
+}
+
+TEST(JitterMeter, StaysUnderTheRealtimeBudget) {
+    // The kernel's defaults: 950 ms of every second.
+    const auto slicing = timetools::detail::getRealtimeSlicing(950000, 1000000);
+    EXPECT_EQ(855000000, slicing.sliceNanoseconds);
+    EXPECT_EQ(145000000, slicing.sleepNanoseconds);
+    // Throttling turned off, or a budget as long as the period.
+    EXPECT_EQ(UINT64_MAX, timetools::detail::getRealtimeSlicing(-1, 1000000).sliceNanoseconds);
+    EXPECT_EQ(UINT64_MAX, timetools::detail::getRealtimeSlicing(1000000, 1000000).sliceNanoseconds);
+}
@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <thread>
+
+#include "../../lib/include/LoadGenerator.h"
+
+TEST(LoadGenerator, SchedulesHaveTheRate) {
+    timetools::LoadOptions options;
+    options.requestsPerSecond = 1000;
+    options.durationNanoseconds = 1000000000;
+    const auto constant = timetools::makeLoadSchedule(options);
+    ASSERT_EQ(1000, constant.size());
+    EXPECT_EQ(0, constant.front());
+    EXPECT_EQ(1000000, constant[1]);
+    EXPECT_EQ(999000000, constant.back());
+
+    options.arrivals = timetools::ArrivalProcess::Poisson;
+    const auto poisson = timetools::makeLoadSchedule(options);
+    EXPECT_NEAR(1000, static_cast<double>(poisson.size()), 150);
+    EXPECT_TRUE(std::is_sorted(poisson.begin(), poisson.end()));
+    EXPECT_EQ(poisson, timetools::makeLoadSchedule(options));
+
+    options.trace = {0, 10, 500};
+    EXPECT_EQ(options.trace, timetools::makeLoadSchedule(options));
+}
+
+TEST(LoadGenerator, TracesSentAllAtOnceHaveNoTargetRate) {
+    timetools::TimerFactory factory;
+    timetools::LoadOptions options;
+    options.trace = {1000, 1000, 1000};
+    const auto report = timetools::generateLoad(factory, options, [](uint64_t) {});
+    EXPECT_EQ(3, report.requests);
+    EXPECT_EQ(0, report.targetRequestsPerSecond);
+    EXPECT_EQ(3, report.latencyNanoseconds.getCount());
+}
+
+TEST(LoadGenerator, StallsAreChargedToTheRequestsTheyHeldBack) {
+    timetools::TimerFactory factory;
+    timetools::LoadOptions options;
+    options.requestsPerSecond = 20000;
+    options.durationNanoseconds = 50000000;
+    // One request stalls for 5ms, a tenth of the run. A closed loop would record one slow request; measured from
+    // the intended send times, the hundred requests scheduled during the stall are all slow too.
+    constexpr uint64_t STALLED_REQUEST = 200;
+    const auto report = timetools::generateLoad(factory, options, [](const uint64_t request) {
+        if (request == STALLED_REQUEST)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    });
+    EXPECT_EQ(0, report.error);
+    EXPECT_EQ(1000, report.requests);
+    EXPECT_EQ(1000, report.latencyNanoseconds.getCount());
+    EXPECT_GE(report.latencyNanoseconds.getMaximum(), 5000000);
+    EXPECT_GE(report.latencyNanoseconds.getValueAtPercentile(95), 1000000);
+    EXPECT_GE(report.sendDelayNanoseconds.getValueAtPercentile(95), 1000000);
+    // The senders catch up after the stall, so the run takes about as long as scheduled.
+    EXPECT_NEAR(options.requestsPerSecond, report.achievedRequestsPerSecond, options.requestsPerSecond * 0.1);
+
+    std::ostringstream out;
+    report.print(out);
+    EXPECT_NE(std::string::npos, out.str().find("send delay"));
+}
+
+TEST(LoadGenerator, EarlyWakeupsDontWrapLatencies) {
+    timetools::TimerFactory factory;
+    timetools::LoadOptions options;
+    options.requestsPerSecond = 5000;
+    options.durationNanoseconds = 20000000;
+    // Sleeping waiters can return a little before the send time, and sending nothing completes at once.
+    options.strategy = timetools::WaitStrategy::ThreadSleep;
+    const auto report = timetools::generateLoad(factory, options, [](uint64_t) {
+    });
+    EXPECT_EQ(100, report.latencyNanoseconds.getCount());
+    EXPECT_LT(report.latencyNanoseconds.getMaximum(), 1000000000);
+    EXPECT_LT(report.elapsedNanoseconds, 1000000000);
+}
@@ -0,0 +1,47 @@
+#include <gtest/gtest.h>
+
+#include "../../lib/include/Microbenchmark.h"
+
+static uint64_t sumTo(const uint64_t count) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+        sum += i;
+        // Keeps the compiler from replacing the loop with a formula.
+        timetools::doNotOptimize(sum);
+    }
+    return sum;
+}
+
+TEST(Microbenchmark, ScalesWithWork) {
+    timetools::TimerFactory factory;
+    timetools::MeasureOptions options;
+    options.warmupNanoseconds = 1000000;
+    uint64_t count = 100;
+    const auto fewer = timetools::measure(factory, [&count]() {
+        timetools::doNotOptimize(count);
+        timetools::doNotOptimize(sumTo(count));
+    }, options);
+    count = 1000;
+    const auto more = timetools::measure(factory, [&count]() {
+        timetools::doNotOptimize(count);
+        timetools::doNotOptimize(sumTo(count));
+    }, options);
+    std::cout << "100 additions: " << fewer.nanosecondsPerOperation << " ns, " << fewer.ticksPerOperation
+            << " ticks\n1000 additions: " << more.nanosecondsPerOperation << " ns, " << more.ticksPerOperation
+            << " ticks\n";
+    EXPECT_GT(fewer.batchSize, more.batchSize);
+    EXPECT_GT(fewer.keptBatches, options.batches / 2);
+    // The fastest batches, since another process can slow down every batch of one run on a busy machine.
+    EXPECT_NEAR(10, more.minimumNanosecondsPerOperation / fewer.minimumNanosecondsPerOperation, 3);
+    EXPECT_LE(fewer.minimumNanosecondsPerOperation, fewer.nanosecondsPerOperation);
+}
+
+TEST(Microbenchmark, EmptyCallableCostsAlmostNothing) {
+    timetools::TimerFactory factory;
+    timetools::MeasureOptions options;
+    options.warmupNanoseconds = 1000000;
+    const auto result = timetools::measure(factory, []() {
+        timetools::clobberMemory();
+    }, options);
+    EXPECT_LT(result.nanosecondsPerOperation, 2);
+}
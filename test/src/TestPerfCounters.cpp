@@ -0,0 +1,38 @@
+#include <gtest/gtest.h>
+#include <cmath>
+
+#include "../../lib/include/Microbenchmark.h"
+#include "../../lib/include/PerfCounters.h"
+
+TEST(PerfCounters, CountsPageFaultsAndTime) {
+    constexpr size_t PAGES = 256;
+    timetools::TimerFactory factory;
+    timetools::CounterStopwatch stopwatch(factory);
+    stopwatch.start();
+    std::vector<char> memory(PAGES * 4096);
+    for (size_t i = 0; i < memory.size(); i += 4096)
+        memory[i] = 1;
+    timetools::doNotOptimize(memory.data());
+    stopwatch.stop();
+
+    const auto report = stopwatch.report(PAGES);
+    for (const auto &counter: report.counters) {
+        std::cout << counter.name << ": " << (counter.available ? std::to_string(counter.count) : "unavailable")
+                << "\n";
+    }
+    std::cout << "IPC " << report.instructionsPerCycle << "\n";
+    // Timing must work even where perf is restricted.
+    EXPECT_GT(report.elapsedNanoseconds, 0);
+    EXPECT_EQ(report.counters.size(), timetools::getDefaultPerfEvents().size());
+    if (!stopwatch.hasCounters())
+        GTEST_SKIP() << "perf_event_open is unavailable";
+
+    for (const auto &counter: report.counters) {
+        if (counter.name == "page-faults" && counter.available)
+            EXPECT_GE(counter.count, PAGES / 2);
+        if (counter.name == "instructions" && counter.available)
+            EXPECT_GT(counter.perOperation, 1);
+    }
+    stopwatch.reset();
+    EXPECT_EQ(0, stopwatch.report().counters.front().count);
+}
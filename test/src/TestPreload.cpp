@@ -0,0 +1,46 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <time.h>
+#include <string>
+
+// Runs a command with the sleep shim preloaded and its counters printed, and returns what it wrote.
+static std::string runPreloaded(const std::string &command) {
+    const auto line = std::string("LD_PRELOAD=") + TIMETOOLS_PRELOAD_PATH + " TIMETOOLS_PRELOAD_STATS=1 " + command
+                      + " 2>&1";
+    auto *pipe = popen(line.c_str(), "r");
+    if (pipe == nullptr)
+        return {};
+    std::string output;
+    char buffer[256];
+    while (fgets(buffer, sizeof(buffer), pipe) != nullptr)
+        output += buffer;
+    pclose(pipe);
+    return output;
+}
+
+TEST(Preload, SpinsShortSleepsAndPassesLongOnesThrough) {
+    EXPECT_NE(std::string::npos, runPreloaded("sleep 0.00002").find(" 1 sleeps spun for 20000 ns"));
+    EXPECT_NE(std::string::npos,
+              runPreloaded("sleep 0.2").find(" 0 sleeps spun for 0 ns, saving about 0 ns; 1 passed"));
+    EXPECT_NE(std::string::npos,
+              runPreloaded("env TIMETOOLS_PRELOAD_THRESHOLD_NS=300000000 sleep 0.2").find(" 1 sleeps spun"));
+}
+
+TEST(Preload, SpunSleepsLastAsLongAsAsked) {
+    // Loaded in this process instead, so that the time taken doesn't include starting a program and calibrating.
+    setenv("TIMETOOLS_PRELOAD_THRESHOLD_NS", "100000000", 1);
+    auto *library = dlopen(TIMETOOLS_PRELOAD_PATH, RTLD_NOW | RTLD_LOCAL);
+    unsetenv("TIMETOOLS_PRELOAD_THRESHOLD_NS");
+    ASSERT_NE(nullptr, library) << dlerror();
+    const auto spinningNanosleep = reinterpret_cast<int (*)(const timespec *, timespec *)>(dlsym(library, "nanosleep"));
+    ASSERT_NE(nullptr, spinningNanosleep);
+    for (const long nanoseconds : {50000L, 2000000L, 50000000L}) {
+        const timespec duration{0, nanoseconds};
+        const auto start = std::chrono::steady_clock::now();
+        EXPECT_EQ(0, spinningNanosleep(&duration, nullptr));
+        EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::nanoseconds(nanoseconds));
+    }
+}
@@ -0,0 +1,61 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <thread>
+
+#include "../../lib/include/RateLimiter.h"
+
+TEST(RateLimiter, AllowsTheBurstThenTheRate) {
+    timetools::TimerFactory factory;
+    constexpr double TOKENS_PER_SECOND = 100000;
+    timetools::RateLimiter limiter(factory, TOKENS_PER_SECOND, 50);
+    EXPECT_EQ(50, limiter.getAvailableTokens());
+    EXPECT_FALSE(limiter.tryAcquire(51));
+    EXPECT_TRUE(limiter.tryAcquire(30));
+    EXPECT_TRUE(limiter.tryAcquire(20));
+    EXPECT_FALSE(limiter.tryAcquire());
+
+    // Each wait is for one more token's worth of refill, so the rate holds however the waits are served.
+    constexpr int WAITS = 2000;
+    const auto before = std::chrono::steady_clock::now();
+    for (int i = 0; i < WAITS; ++i)
+        EXPECT_TRUE(limiter.waitFor());
+    const auto elapsed = std::chrono::steady_clock::now() - before;
+    const auto expected = std::chrono::nanoseconds(static_cast<long>(WAITS / TOKENS_PER_SECOND * 1e9));
+    EXPECT_GE(elapsed, expected * 0.99);
+    EXPECT_LT(elapsed, expected * 1.1 + std::chrono::milliseconds(10));
+
+    EXPECT_THROW(timetools::RateLimiter(factory, 0, 1), std::invalid_argument);
+    EXPECT_THROW(timetools::RateLimiter(factory, 1, 0), std::invalid_argument);
+}
+
+TEST(RateLimiter, ThreadsShareOneBudget) {
+    timetools::TimerFactory factory;
+    constexpr double TOKENS_PER_SECOND = 200000;
+    constexpr uint64_t BURST = 1000;
+    timetools::RateLimiter limiter(factory, TOKENS_PER_SECOND, BURST);
+    timetools::ShardedRateLimiter sharded(factory, TOKENS_PER_SECOND, BURST, 4);
+    EXPECT_EQ(4, sharded.getShardCount());
+    EXPECT_EQ(BURST / 4, sharded.getShardBurst());
+    EXPECT_EQ(BURST, sharded.getAvailableTokens());
+
+    std::atomic<uint64_t> granted = 0, shardedGranted = 0;
+    const auto before = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < 4; ++thread) {
+        threads.emplace_back([&]() {
+            while (std::chrono::steady_clock::now() - before < std::chrono::milliseconds(20)) {
+                granted += limiter.tryAcquire();
+                shardedGranted += sharded.tryAcquire();
+            }
+        });
+    }
+    for (auto &thread: threads)
+        thread.join();
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - before).count();
+    const auto allowed = static_cast<double>(BURST) + TOKENS_PER_SECOND * seconds;
+    std::cout << granted << " and " << shardedGranted << " granted of " << allowed << " allowed\n";
+    EXPECT_LE(granted, allowed + 1);
+    EXPECT_LE(shardedGranted, allowed + 4);
+    EXPECT_GE(granted, BURST);
+    EXPECT_GE(shardedGranted, BURST);
+}
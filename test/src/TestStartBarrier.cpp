@@ -0,0 +1,42 @@
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "../../lib/include/StartBarrier.h"
+
+TEST(StartBarrier, ReleasesEveryRoundAtItsDeadline) {
+    constexpr unsigned int THREADS = 4;
+    constexpr int ROUNDS = 20;
+    timetools::TimerFactory factory;
+    timetools::StartBarrier barrier(factory, THREADS, 100000);
+    std::vector<std::vector<uint64_t>> deadlines(THREADS);
+    std::vector<std::vector<uint64_t>> leftAt(THREADS);
+    std::vector<std::thread> threads;
+    for (unsigned int thread = 0; thread < THREADS; ++thread) {
+        threads.emplace_back([&, thread]() {
+            // Arrive at different times.
+            std::this_thread::sleep_for(std::chrono::milliseconds(thread));
+            for (int round = 0; round < ROUNDS; ++round) {
+                deadlines[thread].push_back(barrier.arriveAndWait());
+                leftAt[thread].push_back(__rdtsc());
+            }
+        });
+    }
+    for (auto &thread: threads)
+        thread.join();
+
+    for (int round = 0; round < ROUNDS; ++round) {
+        for (unsigned int thread = 0; thread < THREADS; ++thread) {
+            EXPECT_EQ(deadlines[0][round], deadlines[thread][round]);
+            EXPECT_GE(leftAt[thread][round], deadlines[thread][round]);
+            if (round > 0)
+                EXPECT_GT(deadlines[thread][round], leftAt[thread][round - 1]);
+        }
+    }
+    const auto release = barrier.getLastRelease();
+    EXPECT_EQ(deadlines[0].back(), release.deadlineTsc);
+    EXPECT_LE(release.skewNanoseconds, release.maximumLatenessNanoseconds + 1);
+    EXPECT_EQ(ROUNDS, barrier.getSkews().getCount());
+    std::cout << "Median skew " << barrier.getSkews().getValueAtPercentile(50) << " ns, last round's lateness "
+            << release.maximumLatenessNanoseconds << " ns\n";
+    EXPECT_THROW(timetools::StartBarrier(factory, 0), std::invalid_argument);
+}
@@ -0,0 +1,111 @@
+#include <gtest/gtest.h>
+
+#include "../../lib/include/timetools.h"
+
+#include <coroutine>
+#include <thread>
+
+namespace {
+    struct Timer {
+        uint64_t deadlineTsc;
+        std::atomic<int> *fired;
+        std::atomic<int> *early;
+    };
+
+    void onTimer(void *context) {
+        const auto &timer = *static_cast<Timer *>(context);
+        if (__rdtsc() < timer.deadlineTsc)
+            ++*timer.early;
+        ++*timer.fired;
+    }
+
+    // A coroutine that starts straight away and cleans itself up when it finishes.
+    struct DetachedTask {
+        struct promise_type {
+            DetachedTask get_return_object() {
+                return {};
+            }
+
+            std::suspend_never initial_suspend() {
+                return {};
+            }
+
+            std::suspend_never final_suspend() noexcept {
+                return {};
+            }
+
+            void return_void() {
+            }
+
+            void unhandled_exception() {
+                std::terminate();
+            }
+        };
+    };
+
+    DetachedTask sleepThenCount(timetools::TimerExecutor &executor, std::atomic<int> &steps, const int times) {
+        for (int i = 0; i < times; ++i) {
+            co_await executor.after(10000);
+            ++steps;
+        }
+    }
+}
+
+TEST(TimerExecutor, FiresEveryTimerOnTime) {
+    timetools::TimerFactory factory;
+    timetools::TimerExecutor executor(factory);
+    constexpr int THREADS = 4;
+    constexpr int TIMERS_PER_THREAD = 25000;
+    std::vector<Timer> timers(THREADS * TIMERS_PER_THREAD);
+    std::atomic<int> fired = 0, early = 0;
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < THREADS; ++thread) {
+        threads.emplace_back([&, thread]() {
+            for (int i = 0; i < TIMERS_PER_THREAD; ++i) {
+                // Spread over 20ms, so that they land on several levels of the wheel.
+                auto &timer = timers[thread * TIMERS_PER_THREAD + i];
+                timer = {__rdtsc() + executor.nanosecondsToTsc(i * 800ull), &fired, &early};
+                while (!executor.scheduleAt(timer.deadlineTsc, &onTimer, &timer))
+                    std::this_thread::yield();
+            }
+        });
+    }
+    for (auto &thread: threads)
+        thread.join();
+    const auto giveUp = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (executor.getFiredCount() < timers.size() && std::chrono::steady_clock::now() < giveUp)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    EXPECT_EQ(timers.size(), fired);
+    EXPECT_EQ(0, early);
+}
+
+TEST(TimerExecutor, ResumesCoroutines) {
+    timetools::TimerFactory factory;
+    timetools::TimerExecutor executor(factory);
+    std::atomic<int> steps = 0;
+    sleepThenCount(executor, steps, 100);
+    const auto giveUp = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (steps < 100 && std::chrono::steady_clock::now() < giveUp)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    EXPECT_EQ(100, steps);
+}
+
+TEST(TimerExecutor, CoroutinesOnTheExecutorThreadDontWaitForTheQueue) {
+    timetools::TimerFactory factory;
+    // Far more coroutines than the queue holds, all resumed and suspended again on the executor thread, which is
+    // the only one that empties the queue. Fewer timer nodes than coroutines, too, so some find none free.
+    timetools::TimerExecutorOptions options;
+    options.queueCapacity = 4;
+    options.maxTimers = 16;
+    timetools::TimerExecutor executor(factory, options);
+    constexpr int COROUTINES = 32;
+    constexpr int STEPS = 20;
+    std::atomic<int> steps = 0;
+    for (int i = 0; i < COROUTINES; ++i)
+        sleepThenCount(executor, steps, STEPS);
+    const auto giveUp = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (steps < COROUTINES * STEPS && std::chrono::steady_clock::now() < giveUp)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    EXPECT_EQ(COROUTINES * STEPS, steps);
+    EXPECT_FALSE(executor.isExecutorThread());
+}
@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+
+#include "../../lib/include/Topology.h"
+
+// Two packages, each with one L3 and two cores of two hyperthreads. Linux numbers the first thread of every core
+// before the second ones, so cpu N and N + 4 are siblings. Cores 2 and 3 (cpus 2, 3, 6 and 7) are isolated.
+static std::string makeFakeSysfs() {
+    const auto root = std::filesystem::temp_directory_path() / ("timetools-topology-" + std::to_string(getpid()));
+    std::filesystem::remove_all(root);
+    const auto write = [](const std::filesystem::path &path, const std::string &contents) {
+        std::filesystem::create_directories(path.parent_path());
+        std::ofstream(path) << contents << "\n";
+    };
+    for (int cpu = 0; cpu < 8; ++cpu) {
+        const auto directory = root / ("cpu" + std::to_string(cpu));
+        const auto core = cpu % 4;
+        const auto package = core / 2;
+        write(directory / "topology/physical_package_id", std::to_string(package));
+        write(directory / "topology/thread_siblings_list", std::to_string(core) + "," + std::to_string(core + 4));
+        write(directory / "cache/index0/level", "1");
+        write(directory / "cache/index0/type", "Data");
+        write(directory / "cache/index0/shared_cpu_list", std::to_string(core) + "," + std::to_string(core + 4));
+        write(directory / "cache/index1/level", "3");
+        write(directory / "cache/index1/type", "Unified");
+        const auto first = package * 2;
+        write(directory / "cache/index1/shared_cpu_list", std::to_string(first) + "-" + std::to_string(first + 1)
+                                                          + "," + std::to_string(first + 4) + "-"
+                                                          + std::to_string(first + 5));
+        std::filesystem::create_directories(directory / ("node" + std::to_string(package)));
+    }
+    write(root / "isolated", "2-3,6-7");
+    return root.string();
+}
+
+TEST(Topology, ReadsSysfs) {
+    const auto root = makeFakeSysfs();
+    const auto topology = timetools::detail::readCpuTopology(root, {0, 1, 2, 3, 4, 5, 6, 7});
+    std::filesystem::remove_all(root);
+    ASSERT_EQ(8, topology.cpus.size());
+    const auto *cpu6 = topology.find(6);
+    ASSERT_NE(nullptr, cpu6);
+    EXPECT_EQ(1, cpu6->package);
+    EXPECT_EQ(1, cpu6->numaNode);
+    EXPECT_EQ(2, cpu6->core);
+    EXPECT_EQ(2, cpu6->cacheDomain);
+    EXPECT_EQ((std::vector<int>{2, 6}), cpu6->smtSiblings);
+    EXPECT_TRUE(cpu6->isolated);
+    EXPECT_FALSE(topology.find(5)->isolated);
+    EXPECT_EQ(nullptr, topology.find(8));
+}
+
+TEST(Topology, KeepsSpinnersOffSiblingsAndGroupsOnOneCache) {
+    const auto root = makeFakeSysfs();
+    const auto topology = timetools::detail::readCpuTopology(root, {0, 1, 2, 3, 4, 5, 6, 7});
+    std::filesystem::remove_all(root);
+    using timetools::ThreadRole;
+    const auto placements = timetools::planThreadPlacement(topology, {
+                                                               {ThreadRole::Background},
+                                                               {ThreadRole::HotWorker, 1},
+                                                               {ThreadRole::Spinning, 1},
+                                                               {ThreadRole::Pacer},
+                                                               {ThreadRole::Spinning},
+                                                           });
+    ASSERT_EQ(5, placements.size());
+    // The spinning threads take the isolated cores, then the pacer the one cpu 0 isn't on.
+    EXPECT_TRUE(topology.find(placements[2].cpu)->isolated);
+    EXPECT_TRUE(topology.find(placements[4].cpu)->isolated);
+    EXPECT_EQ(1, topology.find(placements[3].cpu)->core);
+    for (const auto spinner: {2, 3, 4}) {
+        EXPECT_FALSE(placements[spinner].sharesCore);
+        for (const auto &other: placements)
+            EXPECT_TRUE(&other == &placements[spinner] || other.cpu < 0
+                || topology.find(other.cpu)->core != topology.find(placements[spinner].cpu)->core);
+    }
+    // Every core but cpu 0's has a spinner, so the hot worker has to leave its group's cache, and the background
+    // thread has nowhere to go but the other half of its core.
+    EXPECT_EQ(0, topology.find(placements[1].cpu)->core);
+    EXPECT_EQ(0, topology.find(placements[0].cpu)->core);
+    EXPECT_TRUE(placements[0].sharesCore);
+    EXPECT_NE(placements[0].cpu, placements[1].cpu);
+}
+
+TEST(Topology, KeepsBackgroundOffHotWorkersCores) {
+    const auto root = makeFakeSysfs();
+    const auto topology = timetools::detail::readCpuTopology(root, {0, 1, 2, 3, 4, 5, 6, 7});
+    std::filesystem::remove_all(root);
+    using timetools::ThreadRole;
+    const auto placements = timetools::planThreadPlacement(topology, {
+                                                               {ThreadRole::Background},
+                                                               {ThreadRole::Spinning},
+                                                               {ThreadRole::Spinning},
+                                                               {ThreadRole::HotWorker},
+                                                               {ThreadRole::Background},
+                                                           });
+    ASSERT_EQ(5, placements.size());
+    // The spinners take the isolated cores, and the hot worker the one cpu 0 isn't on. Its sibling, cpu 5, is
+    // free, but the background threads share cpu 0's core between them instead.
+    EXPECT_EQ(1, topology.find(placements[3].cpu)->core);
+    EXPECT_FALSE(placements[3].sharesCore);
+    for (const auto background: {0, 4}) {
+        EXPECT_EQ(0, topology.find(placements[background].cpu)->core);
+        EXPECT_TRUE(placements[background].sharesCore);
+    }
+}
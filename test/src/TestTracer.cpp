@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+
+#include "../../lib/include/timetools.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+static size_t countOccurrences(const std::string &text, const std::string &pattern) {
+    size_t count = 0;
+    for (auto position = text.find(pattern); position != std::string::npos; position = text.find(pattern, position + 1))
+        ++count;
+    return count;
+}
+
+TEST(Tracer, WritesChromeJson) {
+    const auto path = std::filesystem::temp_directory_path() / "timetools-test-trace.bin";
+    timetools::TimerFactory factory;
+    constexpr int THREADS = 4;
+    constexpr int SPANS_PER_THREAD = 10000;
+    {
+        timetools::TracerOptions options;
+        // Big enough for everything, in case threads reuse one ring without the drainer getting a turn.
+        options.recordsPerThread = 1 << 17;
+        options.fileGrowthRecords = 1 << 10;
+        options.drainIntervalNanoseconds = 100000;
+        timetools::Tracer tracer(factory, path, options);
+        const auto work = tracer.registerEvent("work");
+        const auto depth = tracer.registerEvent("queue \"depth\"");
+        EXPECT_EQ(work, tracer.registerEvent("work"));
+
+        std::vector<std::thread> threads;
+        for (int thread = 0; thread < THREADS; ++thread) {
+            threads.emplace_back([&tracer, work, depth]() {
+                for (int i = 0; i < SPANS_PER_THREAD; ++i) {
+                    tracer.begin(work, i);
+                    tracer.end(work);
+                    if (i % 100 == 0)
+                        tracer.counter(depth, i);
+                }
+            });
+        }
+        for (auto &thread: threads)
+            thread.join();
+        tracer.close();
+        EXPECT_EQ(0, tracer.getDroppedCount());
+    }
+
+    std::stringstream json;
+    ASSERT_EQ(0, timetools::convertTraceToChromeJson(path, json));
+    const auto text = json.str();
+    EXPECT_TRUE(text.starts_with("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["));
+    EXPECT_EQ(THREADS * SPANS_PER_THREAD, countOccurrences(text, "\"ph\":\"B\""));
+    EXPECT_EQ(THREADS * SPANS_PER_THREAD, countOccurrences(text, "\"ph\":\"E\""));
+    EXPECT_EQ(THREADS * SPANS_PER_THREAD / 100, countOccurrences(text, "\"ph\":\"C\""));
+    EXPECT_EQ(THREADS * SPANS_PER_THREAD / 100, countOccurrences(text, "\"name\":\"queue \\\"depth\\\"\""));
+    std::filesystem::remove(path);
+}
+
+TEST(Tracer, DropsWhenFull) {
+    const auto path = std::filesystem::temp_directory_path() / "timetools-test-trace-full.bin";
+    timetools::TimerFactory factory;
+    timetools::TracerOptions options;
+    options.recordsPerThread = 16;
+    options.drainIntervalNanoseconds = 1000000000;
+    timetools::Tracer tracer(factory, path, options);
+    const auto event = tracer.registerEvent("event");
+    // Wait for the drainer to go to sleep.
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    for (int i = 0; i < 100; ++i)
+        tracer.instant(event);
+    EXPECT_EQ(100 - 16, tracer.getDroppedCount());
+    tracer.close();
+
+    std::stringstream json;
+    ASSERT_EQ(0, timetools::convertTraceToChromeJson(path, json));
+    EXPECT_EQ(16, countOccurrences(json.str(), "\"ph\":\"i\""));
+    std::filesystem::remove(path);
+
+    EXPECT_NE(0, timetools::convertTraceToChromeJson(path, json));
+}
+
+TEST(Tracer, DropsRecordsFromThreadsWithoutARing) {
+    const auto path = std::filesystem::temp_directory_path() / "timetools-test-trace-threads.bin";
+    timetools::TimerFactory factory;
+    timetools::TracerOptions options;
+    options.recordsPerThread = 16;
+    timetools::Tracer tracer(factory, path, options);
+    const auto event = tracer.registerEvent("event");
+    // Keep every thread alive until they've all recorded, so that none reuses another's ring.
+    constexpr int THREADS = timetools::Tracer::MAX_THREADS + 44;
+    std::atomic<int> recorded = 0;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < THREADS; ++i) {
+        threads.emplace_back([&]() {
+            tracer.instant(event);
+            ++recorded;
+            while (recorded < THREADS)
+                std::this_thread::yield();
+        });
+    }
+    for (auto &thread: threads)
+        thread.join();
+    EXPECT_GE(tracer.getDroppedCount(), THREADS - timetools::Tracer::MAX_THREADS);
+    tracer.close();
+
+    std::stringstream json;
+    ASSERT_EQ(0, timetools::convertTraceToChromeJson(path, json));
+    EXPECT_EQ(THREADS, countOccurrences(json.str(), "\"ph\":\"i\"") + tracer.getDroppedCount());
+
+    {
+        // A core count far beyond the end of the file is rejected rather than allocated for.
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        uint64_t footerOffset;
+        file.seekg(24);
+        file.read(reinterpret_cast<char *>(&footerOffset), sizeof(footerOffset));
+        const uint32_t coreCount = UINT32_MAX;
+        file.seekp(static_cast<std::streamoff>(footerOffset));
+        file.write(reinterpret_cast<const char *>(&coreCount), sizeof(coreCount));
+    }
+    EXPECT_EQ(EINVAL, timetools::convertTraceToChromeJson(path, json));
+    std::filesystem::remove(path);
+}
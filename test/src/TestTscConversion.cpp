@@ -0,0 +1,48 @@
+#include <gtest/gtest.h>
+#include <random>
+
+#include "../../lib/include/TscConversion.h"
+
+static uint64_t exactNanoseconds(const uint64_t ticks, const uint64_t tscPerNanosecond_shl25) {
+    const auto result = (static_cast<unsigned __int128>(ticks) << 25) / tscPerNanosecond_shl25;
+    return result >> 64 != 0 ? UINT64_MAX : static_cast<uint64_t>(result);
+}
+
+TEST(TscConversion, WithinOneOfExact) {
+    std::mt19937_64 random(42);
+    // From a 1 MHz clock to a 10 GHz one, including nanoseconds themselves.
+    for (const uint64_t rate: {1ull << 25, 33554ull, 96636764ull, 100000000ull, 112938271ull, 335544320ull}) {
+        const timetools::TscConversion conversion(rate);
+        for (int i = 0; i < 10000; ++i) {
+            const auto ticks = random() >> (random() % 64);
+            const auto exact = exactNanoseconds(ticks, rate);
+            const auto nanoseconds = conversion.toNanoseconds(ticks);
+            ASSERT_LE(nanoseconds > exact ? nanoseconds - exact : exact - nanoseconds, 1) << rate << " " << ticks;
+            if (nanoseconds < UINT64_MAX / 2) {
+                const auto back = conversion.toTicks(nanoseconds);
+                // One nanosecond is up to 10 ticks at the fastest rate.
+                ASSERT_LE(back > ticks ? back - ticks : ticks - back, 11) << rate << " " << ticks;
+            }
+        }
+    }
+    EXPECT_EQ(12345678901234ull, timetools::TscConversion(1 << 25).toNanoseconds(12345678901234ull));
+    // Ten hours at 3 GHz, which overflowed the old 16-bit fixed point.
+    const auto threeGigahertz = timetools::TscConversion::fromFrequencyHz(3000000000);
+    EXPECT_EQ(36000000000000ull, threeGigahertz.toNanoseconds(108000000000000ull));
+    EXPECT_EQ(UINT64_MAX, timetools::TscConversion(33554).toNanoseconds(UINT64_MAX));
+}
+
+TEST(TscConversion, BatchMatchesScalar) {
+    std::mt19937_64 random(7);
+    std::vector<uint64_t> ticks(1003);
+    for (auto &value: ticks)
+        value = random() >> (random() % 64);
+    ticks[5] = UINT64_MAX;
+    for (const uint64_t rate: {1ull << 25, 33554ull, 96636764ull, 335544320ull}) {
+        const timetools::TscConversion conversion(rate);
+        std::vector<uint64_t> nanoseconds(ticks.size());
+        conversion.toNanoseconds(ticks.data(), nanoseconds.data(), ticks.size());
+        for (size_t i = 0; i < ticks.size(); ++i)
+            ASSERT_EQ(conversion.toNanoseconds(ticks[i]), nanoseconds[i]) << rate << " " << ticks[i];
+    }
+}